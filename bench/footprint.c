@@ -0,0 +1,47 @@
+#include "chunk.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+extern VM vm;
+
+
+static void report(const char* what, size_t bytes) {
+	printf("%-28s %10zu bytes\n", what, bytes);
+}
+
+
+int main(int argc, char* argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : 10000;
+	vm_create();
+	// The keys live only in a local table, so keep the collector from freeing them.
+	vm.next_gc = SIZE_MAX;
+
+	Table table = table_create();
+	ValueArray constants = value_array_create();
+	char name[32];
+	for (int i = 0; i < count; i++) {
+		int length = snprintf(name, sizeof(name), "global_%d", i);
+		ObjString* key = string_copy(name, length);
+		table_insert(&table, key, VALUE_NUMBER(i));
+		value_array_write(&constants, VALUE_NUMBER(i));
+	}
+
+	printf("== %s, %d keys ==\n", sizeof(Value) == 8 ? "nan-boxed" : "tagged", count);
+	report("Value", sizeof(Value));
+	report("Entry", sizeof(Entry));
+	report("VM stack", sizeof(vm.stack));
+	report("globals table entries", sizeof(Entry) * table.capacity);
+	report("constant array", sizeof(Value) * constants.capacity);
+
+	value_array_free(&constants);
+	table_free(&table);
+	vm_free();
+	return 0;
+}
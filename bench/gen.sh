@@ -0,0 +1,90 @@
+#!/bin/sh
+# Usage: gen.sh <workload> <lines>
+#
+# Prints a line-oriented Lox workload. The language has no loops yet, so each
+# workload is a long run of REPL lines, every line compiled as its own chunk.
+
+workload=$1
+lines=${2:-1000}
+
+case $workload in
+arith)
+	awk -v n="$lines" 'BEGIN {
+		print "var a = 1; var b = 2;"
+		for (i = 0; i < n; i++) {
+			line = "a = a"
+			for (j = 0; j < 20; j++)
+				line = line " + b * 2 - b / 4 + 0.5"
+			print line " - a * 0.5;"
+		}
+		print "print a;"
+	}'
+	;;
+globals)
+	awk -v n="$lines" 'BEGIN {
+		for (g = 0; g < 16; g++)
+			printf "var g%d = %d; ", g, g
+		print ""
+		for (i = 0; i < n; i++) {
+			line = ""
+			for (k = 0; k < 4; k++) {
+				line = line sprintf("g%d = g%d", (i + k) % 16, (i + k + 1) % 16)
+				for (j = 2; j < 16; j++)
+					line = line sprintf(" + g%d", (i + k + j) % 16)
+				line = line " - g0 * 15; "
+			}
+			print line
+		}
+		print "print g0;"
+	}'
+	;;
+strings)
+	awk -v n="$lines" 'BEGIN {
+		print "var s = \"\"; var t = \"-\";"
+		for (i = 0; i < n; i++) {
+			line = ""
+			for (k = 0; k < 8; k++)
+				line = line sprintf("s = \"key\" + t + \"%d\" + t + \"%d\"; ", i, k)
+			print line
+		}
+		print "print s;"
+	}'
+	;;
+heap)
+	awk -v n="$lines" 'BEGIN {
+		for (i = 0; i < n; i++) {
+			line = ""
+			for (k = 0; k < 8; k++)
+				line = line sprintf("var h%d_%d = \"value\" + \"%d_%d\"; ", i, k, i, k)
+			print line
+		}
+		for (i = 0; i < n; i++) {
+			line = ""
+			for (k = 0; k < 8; k++)
+				line = line sprintf("h%d_%d = h%d_%d + \"%d\"; ", i, k, (i * 7) % n, k, k)
+			print line
+		}
+		print "print h0_0;"
+	}'
+	;;
+rope)
+	awk -v n="$lines" 'BEGIN {
+		piece = ""
+		for (j = 0; j < 64; j++)
+			piece = piece sprintf("%c", 97 + j % 26)
+		print "var s = \"\";"
+		for (i = 0; i < n; i++) {
+			line = ""
+			for (k = 0; k < 8; k++)
+				line = line "s = s + \"" piece "\"; "
+			print line
+		}
+		print "print s == s;"
+		print "print s;"
+	}'
+	;;
+*)
+	echo "Unknown workload '$workload'." >&2
+	exit 64
+	;;
+esac
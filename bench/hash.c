@@ -0,0 +1,48 @@
+#include "hash.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define HASH_MAX_LENGTH (1 << 20)
+#define HASH_BYTES_PER_RUN ((size_t)256 << 20)
+
+
+static double now_seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+
+int main() {
+	char* buffer = malloc(HASH_MAX_LENGTH);
+	if (buffer == NULL)
+		return 1;
+	uint32_t state = 12345;
+	for (int i = 0; i < HASH_MAX_LENGTH; i++) {
+		state = state * 1103515245u + 12345u;
+		buffer[i] = (char)(state >> 16);
+	}
+
+	uint32_t sink = 0;
+	printf("%10s %12s %10s\n", "length", "ns/hash", "GB/s");
+	for (size_t length = 1; length <= HASH_MAX_LENGTH; length *= 2) {
+		size_t iterations = HASH_BYTES_PER_RUN / length;
+		if (iterations > 20000000)
+			iterations = 20000000;
+
+		double start = now_seconds();
+		for (size_t i = 0; i < iterations; i++)
+			sink += hash_bytes(buffer + (i & 7) * (length < HASH_MAX_LENGTH), (int)length);
+		double elapsed = now_seconds() - start;
+
+		printf("%10zu %12.2f %10.2f\n", length, elapsed * 1e9 / iterations,
+			(double)length * iterations / elapsed / 1e9);
+	}
+
+	free(buffer);
+	return sink == 0xdeadbeef;
+}
@@ -0,0 +1,83 @@
+#include "bytecode.h"
+#include "chunk.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define LOADER_PATH "bin/loader.loxc"
+
+
+extern VM vm;
+
+
+// Builds `"a" <op> 1; print;` as a .loxc file with a valid checksum, then
+// hands it to the loader, so only the opcode itself can be rejected.
+static const char* load(uint8_t instruction) {
+	Chunk chunk = chunk_create();
+	int text = chunk_write_constant(&chunk, VALUE_OBJECT(string_copy("a", 1)));
+	int one = chunk_write_constant(&chunk, VALUE_NUMBER(1));
+	chunk_write(&chunk, OP_CONSTANT, 1);
+	chunk_write(&chunk, text, 1);
+	if (instruction == OP_ADD_CONSTANT || instruction == OP_ADD_CONSTANT_NUM || instruction == OP_ADD_CONSTANT_STR) {
+		chunk_write(&chunk, instruction, 1);
+		chunk_write(&chunk, one, 1);
+	} else {
+		chunk_write(&chunk, OP_CONSTANT, 1);
+		chunk_write(&chunk, one, 1);
+		chunk_write(&chunk, instruction, 1);
+	}
+	chunk_write(&chunk, OP_PRINT, 1);
+	chunk_write(&chunk, OP_RETURN, 1);
+
+	bool written = bytecode_write(&chunk, LOADER_PATH);
+	chunk_free(&chunk);
+	if (!written) {
+		fprintf(stderr, "Could not write \"%s\".\n", LOADER_PATH);
+		exit(74);
+	}
+
+	FILE* file = fopen(LOADER_PATH, "rb");
+	if (file == NULL)
+		exit(74);
+	uint8_t data[256];
+	size_t size = fread(data, 1, sizeof(data), file);
+	fclose(file);
+	remove(LOADER_PATH);
+
+	chunk = chunk_create();
+	const char* error = bytecode_read(&chunk, data, size, false);
+	chunk_free(&chunk);
+	return error;
+}
+
+
+static bool expect(const char* name, uint8_t instruction, const char* expected) {
+	const char* error = load(instruction);
+	bool passed = expected == NULL ? error == NULL : error != NULL && strcmp(error, expected) == 0;
+	printf("%-22s %-26s %s\n", name, error == NULL ? "loaded" : error, passed ? "ok" : "FAILED");
+	return passed;
+}
+
+
+int main() {
+	vm_create();
+	// The chunks are built outside the compiler, so keep the collector away.
+	vm.next_gc = SIZE_MAX;
+
+	bool passed = true;
+	passed &= expect("OP_ADD", OP_ADD, NULL);
+	passed &= expect("OP_ADD_CONSTANT", OP_ADD_CONSTANT, NULL);
+	passed &= expect("OP_ADD_NUM", OP_ADD_NUM, "runtime-only instruction");
+	passed &= expect("OP_ADD_STR", OP_ADD_STR, "runtime-only instruction");
+	passed &= expect("OP_ADD_CONSTANT_NUM", OP_ADD_CONSTANT_NUM, "runtime-only instruction");
+	passed &= expect("OP_ADD_CONSTANT_STR", OP_ADD_CONSTANT_STR, "runtime-only instruction");
+
+	vm_free();
+	return passed ? 0 : 1;
+}
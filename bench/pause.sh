@@ -0,0 +1,31 @@
+#!/bin/sh
+# Usage: pause.sh <workload> <lines> <binary> "<flags>"...
+#
+# Runs one workload through the binary once per flag set with --gc-log and
+# prints the wall-clock time, the number of collections and pauses, and the
+# longest single pause.
+
+workload=$1
+lines=$2
+binary=$3
+shift 3
+
+mkdir -p build/bench
+script=build/bench/$workload.lox
+sh "$(dirname "$0")/gen.sh" "$workload" "$lines" > "$script" || exit 1
+
+now_ms() {
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+for flags in "$@"; do
+	start=$(now_ms)
+	report=$("$binary" --gc-log $flags < "$script" 2>&1 > /dev/null | grep -v '^-- gc')
+	elapsed=$(( $(now_ms) - start ))
+
+	collections=$(echo "$report" | awk '/collections/ { print $1 }')
+	pauses=$(echo "$report" | awk '/ pauses/ { print $1 }')
+	max_pause=$(echo "$report" | awk '/max pause/ { print $1 }')
+	printf "%-8s %-24s %6d ms %4s cycles %7s pauses %10s us max pause\n" \
+		"$workload" "${flags:-stop-the-world}" "$elapsed" "$collections" "$pauses" "$max_pause"
+done
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Usage: peephole.sh <binary>
+#
+# Checks that -O removes an instruction from comparisons against a literal,
+# comparing the instruction counts of the code and optimized dumps.
+
+binary=$1
+status=0
+
+for op in "!=" ">=" "<=" "=="; do
+	counts=$(printf 'var x = 2;\nprint x %s 1;\n' "$op" |
+		"$binary" -O --dump-bytecode 2>/dev/null |
+		awk '/== code ==/ { section = "code" } /== optimized ==/ { section = "optimized" }
+			/ OP_/ { count[section]++ }
+			END { print count["code"] + 0, count["optimized"] + 0 }')
+	set -- $counts
+	echo "x $op 1: $1 -> $2 instructions"
+	if [ "$op" = "==" ] && [ "$2" -ne "$1" ]; then
+		echo "expected no change"
+		status=1
+	elif [ "$op" != "==" ] && [ "$2" -ge "$1" ]; then
+		echo "expected fewer"
+		status=1
+	fi
+done
+
+exit $status
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Usage: run.sh "<workloads>" <lines> <binary>...
+#
+# Generates each workload, pipes it through every binary's REPL and prints the
+# best wall-clock time of a few runs in milliseconds.
+
+workloads=$1
+lines=$2
+shift 2
+
+runs=${BENCH_RUNS:-5}
+mkdir -p build/bench
+
+now_ms() {
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+for workload in $workloads; do
+	script=build/bench/$workload.lox
+	sh "$(dirname "$0")/gen.sh" "$workload" "$lines" > "$script" || exit 1
+
+	for binary in "$@"; do
+		best=
+		i=0
+		while [ $i -lt "$runs" ]; do
+			start=$(now_ms)
+			"$binary" $BENCH_FLAGS < "$script" > /dev/null
+			elapsed=$(( $(now_ms) - start ))
+			if [ -z "$best" ] || [ $elapsed -lt "$best" ]; then
+				best=$elapsed
+			fi
+			i=$((i + 1))
+		done
+		printf "%-10s %-24s %6d ms\n" "$workload" "$binary" "$best"
+	done
+done
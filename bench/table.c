@@ -0,0 +1,95 @@
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define TABLE_OPS_PER_RUN 10000000
+
+
+extern VM vm;
+
+
+static double now_seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+
+static void run(int count) {
+	vm_create();
+	// The keys live only in a C array, so keep the collector from freeing them.
+	vm.next_gc = SIZE_MAX;
+
+	ObjString** keys = malloc(sizeof(ObjString*) * count);
+	if (keys == NULL)
+		exit(1);
+	char name[32];
+	for (int i = 0; i < count; i++) {
+		int length = snprintf(name, sizeof(name), "key_%d", i);
+		keys[i] = string_copy(name, length);
+	}
+
+	int rounds = TABLE_OPS_PER_RUN / count > 0 ? TABLE_OPS_PER_RUN / count : 1;
+	double insert = 0, get = 0, delete = 0, intern = 0;
+	size_t bytes = 0;
+	long found = 0;
+	Value value;
+
+	for (int round = 0; round < rounds; round++) {
+		Table table = table_create();
+		size_t before = vm.bytes_allocated;
+
+		double start = now_seconds();
+		for (int i = 0; i < count; i++)
+			found += table_insert(&table, keys[i], VALUE_NUMBER(i));
+		insert += now_seconds() - start;
+		bytes = vm.bytes_allocated - before;
+
+		start = now_seconds();
+		for (int i = 0; i < count; i++)
+			found += table_get(&table, keys[i], &value);
+		get += now_seconds() - start;
+
+		start = now_seconds();
+		for (int i = 0; i < count; i++)
+			found += table_delete(&table, keys[i]);
+		delete += now_seconds() - start;
+
+		table_free(&table);
+	}
+
+	for (int round = 0; round < rounds; round++) {
+		double start = now_seconds();
+		for (int i = 0; i < count; i++) {
+			ObjString* key = keys[i];
+			found += table_find_string(&vm.strings, key->chars, key->length, key->hash) == key;
+		}
+		intern += now_seconds() - start;
+	}
+
+	double ops = (double)rounds * count;
+	printf("%10d %10.2f %10.2f %10.2f %10.2f %10.1f\n", count,
+		insert * 1e9 / ops, get * 1e9 / ops, delete * 1e9 / ops, intern * 1e9 / ops,
+		(double)bytes / count);
+	if (found != 4 * (long)rounds * count)
+		printf("lookup mismatch at %d keys\n", count);
+
+	free(keys);
+	vm_free();
+}
+
+
+int main(int argc, char* argv[]) {
+	int max = argc > 1 ? atoi(argv[1]) : 10000000;
+	printf("%10s %10s %10s %10s %10s %10s\n", "keys", "insert ns", "get ns", "delete ns", "intern ns", "bytes/key");
+	for (int count = 1000; count <= max; count *= 10)
+		run(count);
+	return 0;
+}
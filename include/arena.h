@@ -0,0 +1,19 @@
+#ifndef clox_arena_h
+#define clox_arena_h
+
+#include "common.h"
+
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+	ArenaBlock* blocks;
+} Arena;
+
+
+Arena arena_create();
+void* arena_reallocate(Arena* arena, void* pointer, size_t old_size, size_t new_size);
+void arena_free(Arena* arena);
+
+
+#endif // clox_arena_h
@@ -0,0 +1,18 @@
+#ifndef clox_bytecode_h
+#define clox_bytecode_h
+
+#include "chunk.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define BYTECODE_MAGIC "LOXC"
+#define BYTECODE_VERSION 3
+
+
+bool bytecode_write(Chunk* chunk, const char* path);
+const char* bytecode_read(Chunk* chunk, uint8_t* data, size_t size, bool in_place);
+
+
+#endif // clox_bytecode_h
@@ -1,6 +1,7 @@
 #ifndef clox_chunk_h
 #define clox_chunk_h
 
+#include "arena.h"
 #include "common.h"
 #include "value.h"
 
@@ -17,6 +18,7 @@ typedef enum {
 	OP_MULTIPLY,
 	OP_DIVIDE,
 	OP_EQUAL,
+	OP_NOT_EQUAL,
 	OP_GREATER,
 	OP_LESS,
 	OP_PRINT,
@@ -24,23 +26,82 @@ typedef enum {
 	OP_DEFINE_GLOBAL,
 	OP_GET_GLOBAL,
 	OP_SET_GLOBAL,
+	OP_ADD_CONSTANT,
+	OP_EQUAL_CONSTANT,
+	OP_GREATER_CONSTANT,
+	OP_LESS_CONSTANT,
+	OP_SET_GLOBAL_POP,
+	OP_CONSTANT_LONG,
+	OP_DEFINE_GLOBAL_LONG,
+	OP_GET_GLOBAL_LONG,
+	OP_SET_GLOBAL_LONG,
+	OP_SET_GLOBAL_POP_LONG,
+	OP_ADD_NUM,
+	OP_ADD_STR,
+	OP_ADD_CONSTANT_NUM,
+	OP_ADD_CONSTANT_STR,
+	OP_NOT_EQUAL_CONSTANT,
+	OP_NOT_GREATER_CONSTANT,
+	OP_NOT_LESS_CONSTANT,
+	OPCODE_COUNT,
 } OpCode;
 
 
+// The _LONG instructions take a 24-bit little-endian operand.
+#define OPERAND_LONG_MAX 0xffffff
+
+
+typedef struct {
+	int offset;
+	int line;
+} LineStart;
+
+
 typedef struct {
 	int count;
 	int capacity;
 	uint8_t* code;
 	ValueArray constants;
-	int* lines;
+	int line_count;
+	int line_capacity;
+	LineStart* lines;
+#ifdef CHUNK_ARENA
+	Arena arena;
+#endif
 } Chunk;
 
 
+// Maps each constant already in a chunk to its index, so that repeated
+// numbers and strings share one slot.
+typedef struct {
+	int count;
+	int capacity;
+	int* indices;
+} ConstantCache;
+
+
+#define CHUNK_ALLOCATE(chunk, type, count) \
+	(type*)chunk_reallocate(chunk, NULL, 0, sizeof(type) * (count))
+
+#define CHUNK_GROW_ARRAY(chunk, type, pointer, old_count, new_count) \
+	(type*)chunk_reallocate(chunk, pointer, sizeof(type) * (old_count), sizeof(type) * (new_count))
+
+
 Chunk chunk_create();
 void chunk_write(Chunk* chunk, uint8_t byte, int line);
 void chunk_free(Chunk* chunk);
+void* chunk_reallocate(Chunk* chunk, void* pointer, size_t old_size, size_t new_size);
+void chunk_truncate(Chunk* chunk, int count);
+int chunk_get_line(Chunk* chunk, int offset);
 
 int chunk_write_constant(Chunk* chunk, Value value);
+int chunk_instruction_length(Chunk* chunk, int offset);
+int chunk_operand(Chunk* chunk, int offset);
+void chunk_set_operand(Chunk* chunk, int offset, int operand);
+
+ConstantCache constant_cache_create();
+void constant_cache_free(ConstantCache* cache);
+int chunk_add_constant(Chunk* chunk, ConstantCache* cache, Value value);
 
 
 #endif // clox_chunk_h
@@ -6,8 +6,40 @@
 #include <stdint.h>
 
 
+#ifndef NDEBUG
 #define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
+#endif
+
+// #define GLOBAL_SLOTS
+// #define GLOBAL_CACHE
+// #define HASH_FNV
+// #define TABLE_SWISS
+// #define TABLE_COMPACT
+// #define QUICKENING
+
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+#ifndef NO_PROFILE
+#define PROFILE_EXECUTION
+#endif
+
+#ifndef NO_OBJECT_POOL
+#define OBJECT_POOL
+#endif
+
+#ifndef NO_ROPES
+#define ROPES
+#endif
+
+#ifndef NO_CHUNK_ARENA
+#define CHUNK_ARENA
+#endif
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(NO_FILE_MMAP)
+#define FILE_MMAP
+#endif
 
 
 #endif // clox_common_h
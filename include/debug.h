@@ -7,6 +7,7 @@
 
 void disassemble_chunk(Chunk* chunk, const char* name);
 int disassemble_instruction(Chunk* chunk, int offset);
+const char* opcode_name(uint8_t instruction);
 void token_print(Token* token);
 
 
@@ -0,0 +1,11 @@
+#ifndef clox_hash_h
+#define clox_hash_h
+
+#include "common.h"
+#include <stdint.h>
+
+
+uint32_t hash_bytes(const char* key, int length);
+
+
+#endif // clox_hash_h
@@ -3,6 +3,7 @@
 
 
 #include "common.h"
+#include "value.h"
 
 
 #define GROW_CAPACITY(capacity) \
@@ -20,13 +21,48 @@
 #define FREE(type, pointer) \
 	reallocate(pointer, sizeof(type), 0)
 
+#define GC_HEAP_MIN (1024 * 1024)
+
+#define IS_MARKED(object) ((object)->is_marked == vm.gc_mark)
+
+#define GC_BARRIER(value) \
+	do { \
+		if (vm.gc_state != GC_IDLE) \
+			gc_mark_value(value); \
+	} while (false)
+
+
+typedef enum {
+	GC_IDLE,
+	GC_MARKING,
+	GC_WEAK,
+	GC_SWEEPING,
+} GCState;
+
+
+typedef enum {
+	GC_ROOT_GLOBALS,
+#ifdef GLOBAL_SLOTS
+	GC_ROOT_GLOBAL_VALUES,
+	GC_ROOT_GLOBAL_NAMES,
+#endif
+	GC_ROOT_DONE,
+} GCRoot;
+
 #define ALLOCATE(type, count) \
 	(type*)reallocate(NULL, 0, sizeof(type) * count)
 
 
 
 void* reallocate(void* pointer, size_t old_size, size_t new_size);
+void gc_mark_object(Obj* object);
+void gc_mark_value(Value value);
+void gc_step(size_t budget);
+void gc_collect();
+void gc_report();
 void objects_free();
+void pools_free();
+void memory_report();
 
 
 #endif // clox_memory_h
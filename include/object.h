@@ -6,13 +6,21 @@
 #include <stdint.h>
 
 
+#define ROPE_MIN_LENGTH 64
+#define ROPE_LEAF_MAX 256
+
+
+typedef struct ObjRope ObjRope;
+
 typedef enum {
-	OBJ_STRING
+	OBJ_STRING,
+	OBJ_ROPE,
 } ObjType;
 
 
 struct Obj {
 	ObjType type;
+	bool is_marked;
 	struct Obj* next;
 };
 
@@ -20,11 +28,26 @@ struct Obj {
 struct ObjString {
 	Obj obj;
 	int length;
-	char* chars;
 	uint32_t hash;
+	char chars[];
+};
+
+
+// A lazy concatenation of two strings or ropes. It is flattened into an
+// interned string only when its identity is needed; `flat` then caches the
+// result and the children are dropped.
+struct ObjRope {
+	Obj obj;
+	int length;
+	Value left;
+	Value right;
+	ObjString* flat;
 };
 
 
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
+
 static inline bool object_is_type(Value value, ObjType type) {
 	return IS_OBJECT(value) && AS_OBJECT(value)->type == type;
 }
@@ -32,13 +55,19 @@ static inline bool object_is_type(Value value, ObjType type) {
 
 #define OBJ_TYPE(value) (AS_OBJECT(value)->type)
 #define IS_STRING(value) object_is_type(value, OBJ_STRING)
+#define IS_ROPE(value) object_is_type(value, OBJ_ROPE)
+#define IS_TEXT(value) (IS_STRING(value) || IS_ROPE(value))
 
 #define AS_STRING(value) ((ObjString*)AS_OBJECT(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJECT(value))->chars)
+#define AS_ROPE(value) ((ObjRope*)AS_OBJECT(value))
 
 
 ObjString* string_copy(const char* chars, int length);
-ObjString* take_string(char* chars, int length);
+ObjString* string_allocate(int length);
+ObjString* string_intern(ObjString* string);
+Value string_concatenate(Value a, Value b);
+ObjString* string_flatten(Value value);
 
 void object_print(Value value);
 
@@ -0,0 +1,29 @@
+#ifndef clox_options_h
+#define clox_options_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+typedef struct {
+	bool optimize;
+	bool trace;
+	bool dump_bytecode;
+	bool compile;
+	bool profile;
+	bool profile_pairs;
+	const char* profile_folded;
+	bool mem_stats;
+	bool gc_stress;
+	bool gc_log;
+	double gc_growth;
+	bool gc_incremental;
+	size_t gc_step;
+	bool quicken_stats;
+} Options;
+
+
+int options_parse(int argc, char* argv[]);
+
+
+#endif // clox_options_h
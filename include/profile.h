@@ -0,0 +1,13 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include "chunk.h"
+
+
+void profile_instruction(Chunk* chunk, int offset);
+void profile_chunk_end();
+void profile_skip_lines();
+void profile_report();
+
+
+#endif // clox_profile_h
@@ -1,6 +1,7 @@
 #ifndef clox_table_h
 #define clox_table_h
 
+#include "common.h"
 #include "value.h"
 #include <stdbool.h>
 #include <stdint.h>
@@ -14,17 +15,42 @@ typedef struct {
 
 typedef struct {
 	int count;
+	int tombstones;
 	int capacity;
 	Entry* entries;
+#ifdef TABLE_SWISS
+	uint8_t* control;
+#endif
+#ifdef TABLE_COMPACT
+	void* index;
+#endif
+	// Bumped whenever entries move or are removed, but not when a key is
+	// added, so a cached Entry* stays valid while the version matches.
+	uint32_t version;
 } Table;
 
 
+typedef struct {
+	int capacity;
+	int live;
+	int tombstones;
+	double average_probe;
+	int max_probe;
+} TableStats;
+
+
 Table table_create();
 void table_free(Table* table);
 bool table_insert(Table* table, ObjString* key, Value value);
 void table_add_all(Table* from, Table* to);
 bool table_get(Table* table, ObjString* key, Value* value);
+Entry* table_find_entry(Table* table, ObjString* key);
 bool table_delete(Table* table, ObjString* key);
+bool table_compact(Table* table);
+TableStats table_stats(Table* table);
+
+int table_mark(Table* table, int from, size_t budget);
+int table_remove_white(Table* table, int from, size_t budget);
 
 ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash);
 
@@ -1,16 +1,69 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include "common.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+#ifdef NAN_BOXING
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+#define TAG_UNDEFINED 4
+
+
+typedef uint64_t Value;
+
+
+#define VALUE_FALSE ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define VALUE_TRUE ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+#define VALUE_BOOL(value) ((value) ? VALUE_TRUE : VALUE_FALSE)
+#define VALUE_NIL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define VALUE_UNDEFINED ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define VALUE_NUMBER(value) value_from_number(value)
+#define VALUE_OBJECT(object) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object))
+
+#define AS_BOOL(value) ((value) == VALUE_TRUE)
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_OBJECT(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define IS_BOOL(value) (((value) | 1) == VALUE_TRUE)
+#define IS_NIL(value) ((value) == VALUE_NIL)
+#define IS_UNDEFINED(value) ((value) == VALUE_UNDEFINED)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJECT(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+
+static inline double value_to_number(Value value) {
+	double number;
+	memcpy(&number, &value, sizeof(Value));
+	return number;
+}
+
+
+static inline Value value_from_number(double number) {
+	Value value;
+	memcpy(&value, &number, sizeof(double));
+	return value;
+}
+
+#else
+
 typedef enum {
 	VAL_NUMBER,
 	VAL_BOOL,
 	VAL_NIL,
 	VAL_OBJ,
+	VAL_UNDEFINED,
 } ValueType;
 
 
@@ -26,6 +79,7 @@ typedef struct {
 
 #define VALUE_BOOL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define VALUE_NIL ((Value){VAL_NIL, {.number = 0}})
+#define VALUE_UNDEFINED ((Value){VAL_UNDEFINED, {.number = 0}})
 #define VALUE_NUMBER(value) ((Value){VAL_NUMBER, {.number = value}})
 #define VALUE_OBJECT(object) ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
@@ -35,9 +89,12 @@ typedef struct {
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJECT(value) ((value).type == VAL_OBJ)
 
+#endif
+
 
 typedef struct {
 	int capacity;
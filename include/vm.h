@@ -3,6 +3,7 @@
 
 
 #include "chunk.h"
+#include "memory.h"
 #include "table.h"
 #include "value.h"
 #include <stdint.h>
@@ -11,6 +12,12 @@
 #define STACK_MAX 256
 
 
+typedef struct {
+	Entry* entry;
+	uint32_t version;
+} GlobalCache;
+
+
 typedef struct {
 	Chunk* chunk;
 	uint8_t* ip;
@@ -18,7 +25,29 @@ typedef struct {
 	Value* stack_top;
 	Table strings;
 	Obj* objects;
+	size_t bytes_allocated;
+	size_t next_gc;
+	GCState gc_state;
+	bool gc_mark;
+	int gc_root;
+	int gc_cursor;
+	int gc_cursor_capacity;
+	Obj** gc_sweep;
+	int gray_count;
+	int gray_capacity;
+	Obj** gray_stack;
+	bool profiling;
+	bool tracing;
 	Table globals;
+#ifdef GLOBAL_SLOTS
+	ValueArray global_values;
+	ValueArray global_names;
+#elif defined(GLOBAL_CACHE)
+	GlobalCache* global_caches;
+#endif
+#ifdef QUICKENING
+	uint8_t* guard_misses;
+#endif
 } VM;
 
 
@@ -33,8 +62,17 @@ void vm_create();
 void vm_free();
 
 InterpretResult vm_interpret(const char* source);
+InterpretResult vm_interpret_chunk(Chunk* chunk);
+#ifdef QUICKENING
+void quicken_report();
+#endif
 void vm_push(Value value);
 Value vm_pop();
 
+#ifdef GLOBAL_SLOTS
+int vm_global_slot(ObjString* name);
+ObjString* vm_global_name(int slot);
+#endif
+
 
 #endif // clox_vm_h
@@ -0,0 +1,83 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+
+struct ArenaBlock {
+	ArenaBlock* next;
+	size_t capacity;
+	size_t used;
+	uint8_t data[];
+};
+
+
+Arena arena_create() {
+	Arena arena;
+	arena.blocks = NULL;
+	return arena;
+}
+
+
+static void* arena_allocate(Arena* arena, size_t size) {
+	ArenaBlock* block = arena->blocks;
+	if (block == NULL || block->capacity - block->used < size) {
+		size_t capacity = block == NULL ? ARENA_BLOCK_SIZE : block->capacity * 2;
+		while (capacity < size)
+			capacity *= 2;
+
+		block = malloc(sizeof(ArenaBlock) + capacity);
+		if (block == NULL)
+			exit(1);
+		block->next = arena->blocks;
+		block->capacity = capacity;
+		block->used = 0;
+		arena->blocks = block;
+	}
+
+	void* result = block->data + block->used;
+	block->used += size;
+	return result;
+}
+
+
+// Memory is only given back by arena_free. Growing the most recent
+// allocation extends it in place, anything else is copied to the top.
+void* arena_reallocate(Arena* arena, void* pointer, size_t old_size, size_t new_size) {
+	if (new_size == 0)
+		return NULL;
+	if (new_size <= old_size)
+		return pointer;
+
+	size_t old_aligned = ARENA_ALIGN(old_size);
+	size_t new_aligned = ARENA_ALIGN(new_size);
+	ArenaBlock* block = arena->blocks;
+	if (
+		pointer != NULL &&
+		(uint8_t*)pointer + old_aligned == block->data + block->used &&
+		block->capacity - block->used >= new_aligned - old_aligned
+	) {
+		block->used += new_aligned - old_aligned;
+		return pointer;
+	}
+
+	void* result = arena_allocate(arena, new_aligned);
+	if (pointer != NULL)
+		memcpy(result, pointer, old_size);
+	return result;
+}
+
+
+void arena_free(Arena* arena) {
+	ArenaBlock* block = arena->blocks;
+	while (block != NULL) {
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+}
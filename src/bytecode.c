@@ -0,0 +1,473 @@
+#include "bytecode.h"
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "options.h"
+#include "value.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define FLAG_GLOBAL_SLOTS 1
+#define FLAG_OPTIMIZED 2
+
+#define CONSTANT_NUMBER 0
+#define CONSTANT_STRING 1
+
+
+typedef struct {
+	uint8_t* data;
+	int count;
+	int capacity;
+} Writer;
+
+
+typedef struct {
+	uint8_t* data;
+	size_t size;
+	size_t position;
+	bool in_place;
+	const char* error;
+} Reader;
+
+
+extern Options options;
+extern VM vm;
+
+
+static uint32_t checksum(const uint8_t* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+
+static void write_bytes(Writer* writer, const void* bytes, int count) {
+	if (writer->capacity < writer->count + count) {
+		int old_capacity = writer->capacity;
+		while (writer->capacity < writer->count + count)
+			writer->capacity = GROW_CAPACITY(writer->capacity);
+		writer->data = GROW_ARRAY(uint8_t, writer->data, old_capacity, writer->capacity);
+	}
+	memcpy(writer->data + writer->count, bytes, count);
+	writer->count += count;
+}
+
+
+static void write_u8(Writer* writer, uint8_t value) {
+	write_bytes(writer, &value, 1);
+}
+
+
+static void write_u32(Writer* writer, uint32_t value) {
+	uint8_t bytes[4];
+	for (int i = 0; i < 4; i++)
+		bytes[i] = (uint8_t)(value >> (8 * i));
+	write_bytes(writer, bytes, 4);
+}
+
+
+static void write_number(Writer* writer, double number) {
+	uint64_t bits;
+	memcpy(&bits, &number, sizeof(double));
+	write_u32(writer, (uint32_t)bits);
+	write_u32(writer, (uint32_t)(bits >> 32));
+}
+
+
+static void write_string(Writer* writer, ObjString* string) {
+	write_u32(writer, string->length);
+	write_bytes(writer, string->chars, string->length + 1);
+}
+
+
+static uint8_t header_flags() {
+	uint8_t flags = options.optimize ? FLAG_OPTIMIZED : 0;
+#ifdef GLOBAL_SLOTS
+	flags |= FLAG_GLOBAL_SLOTS;
+#endif
+	return flags;
+}
+
+
+bool bytecode_write(Chunk* chunk, const char* path) {
+	Writer writer = {NULL, 0, 0};
+
+	write_bytes(&writer, BYTECODE_MAGIC, 4);
+	write_u8(&writer, BYTECODE_VERSION);
+	write_u8(&writer, header_flags());
+	write_u8(&writer, OPCODE_COUNT);
+	write_u8(&writer, 0);
+
+	write_u32(&writer, chunk->count);
+	write_bytes(&writer, chunk->code, chunk->count);
+
+	write_u32(&writer, chunk->line_count);
+	for (int i = 0; i < chunk->line_count; i++) {
+		write_u32(&writer, chunk->lines[i].offset);
+		write_u32(&writer, chunk->lines[i].line);
+	}
+
+	write_u32(&writer, chunk->constants.count);
+	for (int i = 0; i < chunk->constants.count; i++) {
+		Value value = chunk->constants.values[i];
+		if (IS_STRING(value)) {
+			write_u8(&writer, CONSTANT_STRING);
+			write_string(&writer, AS_STRING(value));
+		} else {
+			write_u8(&writer, CONSTANT_NUMBER);
+			write_number(&writer, AS_NUMBER(value));
+		}
+	}
+
+#ifdef GLOBAL_SLOTS
+	write_u32(&writer, vm.global_names.count);
+	for (int i = 0; i < vm.global_names.count; i++)
+		write_string(&writer, vm_global_name(i));
+#endif
+
+	write_u32(&writer, checksum(writer.data, writer.count));
+
+	bool written = false;
+	FILE* file = fopen(path, "wb");
+	if (file != NULL) {
+		written = fwrite(writer.data, 1, writer.count, file) == (size_t)writer.count;
+		written = fclose(file) == 0 && written;
+	}
+
+	FREE_ARRAY(uint8_t, writer.data, writer.capacity);
+	return written;
+}
+
+
+static uint8_t* read_bytes(Reader* reader, size_t count) {
+	if (reader->error != NULL) return NULL;
+	if (count > reader->size - reader->position) {
+		reader->error = "unexpected end of file";
+		return NULL;
+	}
+
+	uint8_t* bytes = reader->data + reader->position;
+	reader->position += count;
+	return bytes;
+}
+
+
+static uint8_t read_u8(Reader* reader) {
+	const uint8_t* bytes = read_bytes(reader, 1);
+	return bytes == NULL ? 0 : bytes[0];
+}
+
+
+static uint32_t read_u32(Reader* reader) {
+	const uint8_t* bytes = read_bytes(reader, 4);
+	if (bytes == NULL) return 0;
+
+	uint32_t value = 0;
+	for (int i = 0; i < 4; i++)
+		value |= (uint32_t)bytes[i] << (8 * i);
+	return value;
+}
+
+
+static uint32_t read_count(Reader* reader, size_t element_size) {
+	uint32_t count = read_u32(reader);
+	if (reader->error == NULL && (size_t)count * element_size > reader->size - reader->position)
+		reader->error = "count exceeds file size";
+	return reader->error == NULL ? count : 0;
+}
+
+
+static double read_number(Reader* reader) {
+	uint64_t bits = read_u32(reader);
+	bits |= (uint64_t)read_u32(reader) << 32;
+
+	double number;
+	memcpy(&number, &bits, sizeof(double));
+	return number;
+}
+
+
+static ObjString* read_string(Reader* reader) {
+	uint32_t length = read_count(reader, 1);
+	const uint8_t* chars = read_bytes(reader, (size_t)length + 1);
+	if (chars == NULL) return NULL;
+	if (chars[length] != '\0') {
+		reader->error = "unterminated string";
+		return NULL;
+	}
+	return string_copy((const char*)chars, (int)length);
+}
+
+
+static int stack_pops(uint8_t instruction) {
+	switch (instruction) {
+	case OP_NEGATE:
+	case OP_NOT:
+	case OP_PRINT:
+	case OP_POP:
+	case OP_DEFINE_GLOBAL:
+	case OP_SET_GLOBAL:
+	case OP_SET_GLOBAL_POP:
+	case OP_DEFINE_GLOBAL_LONG:
+	case OP_SET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_POP_LONG:
+	case OP_ADD_CONSTANT:
+	case OP_EQUAL_CONSTANT:
+	case OP_GREATER_CONSTANT:
+	case OP_LESS_CONSTANT:
+	case OP_NOT_EQUAL_CONSTANT:
+	case OP_NOT_GREATER_CONSTANT:
+	case OP_NOT_LESS_CONSTANT:
+		return 1;
+	case OP_ADD:
+	case OP_SUBTRACT:
+	case OP_MULTIPLY:
+	case OP_DIVIDE:
+	case OP_EQUAL:
+	case OP_NOT_EQUAL:
+	case OP_GREATER:
+	case OP_LESS:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+
+static int stack_pushes(uint8_t instruction) {
+	switch (instruction) {
+	case OP_RETURN:
+	case OP_PRINT:
+	case OP_POP:
+	case OP_DEFINE_GLOBAL:
+	case OP_SET_GLOBAL_POP:
+	case OP_DEFINE_GLOBAL_LONG:
+	case OP_SET_GLOBAL_POP_LONG:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+
+static bool is_global_op(uint8_t instruction) {
+	switch (instruction) {
+	case OP_DEFINE_GLOBAL:
+	case OP_GET_GLOBAL:
+	case OP_SET_GLOBAL:
+	case OP_SET_GLOBAL_POP:
+	case OP_DEFINE_GLOBAL_LONG:
+	case OP_GET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_POP_LONG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+// The VM rewrites generic instructions into these as it runs, trusting
+// that the guard which picked them still holds; they never come from the
+// compiler, so a file containing one has been tampered with.
+static bool is_quickened_op(uint8_t instruction) {
+	switch (instruction) {
+	case OP_ADD_NUM:
+	case OP_ADD_STR:
+	case OP_ADD_CONSTANT_NUM:
+	case OP_ADD_CONSTANT_STR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+static const char* chunk_validate(Chunk* chunk) {
+	if (chunk->count == 0 || chunk->line_count == 0 || chunk->lines[0].offset != 0)
+		return "missing code or line table";
+
+	for (int i = 1; i < chunk->line_count; i++) {
+		if (chunk->lines[i].offset <= chunk->lines[i - 1].offset || chunk->lines[i].offset >= chunk->count)
+			return "malformed line table";
+	}
+
+	int depth = 0;
+	int offset = 0;
+	uint8_t instruction = OP_RETURN;
+	while (offset < chunk->count) {
+		instruction = chunk->code[offset];
+		if (instruction >= OPCODE_COUNT)
+			return "unknown opcode";
+		if (is_quickened_op(instruction))
+			return "runtime-only instruction";
+
+		int length = chunk_instruction_length(chunk, offset);
+		if (offset + length > chunk->count)
+			return "truncated instruction";
+
+		if (length > 1) {
+			int operand = chunk_operand(chunk, offset);
+#ifdef GLOBAL_SLOTS
+			bool is_constant = !is_global_op(instruction);
+#else
+			bool is_constant = true;
+#endif
+			if (is_constant && operand >= chunk->constants.count)
+				return "constant index out of range";
+			if (is_constant && is_global_op(instruction) && !IS_STRING(chunk->constants.values[operand]))
+				return "global name is not a string";
+		}
+
+		depth -= stack_pops(instruction);
+		if (depth < 0)
+			return "stack underflow";
+		depth += stack_pushes(instruction);
+		if (depth > STACK_MAX)
+			return "stack overflow";
+
+		offset += length;
+	}
+
+	if (instruction != OP_RETURN)
+		return "code does not end with OP_RETURN";
+	return NULL;
+}
+
+
+#ifdef GLOBAL_SLOTS
+static const char* globals_relink(Chunk* chunk, Reader* reader) {
+	uint32_t count = read_count(reader, 4);
+	if (reader->error != NULL) return reader->error;
+
+	int* slots = ALLOCATE(int, count);
+	for (uint32_t i = 0; i < count; i++) {
+		ObjString* name = read_string(reader);
+		slots[i] = name == NULL ? 0 : vm_global_slot(name);
+	}
+
+	const char* error = reader->error;
+	for (int offset = 0; error == NULL && offset < chunk->count; offset += chunk_instruction_length(chunk, offset)) {
+		if (!is_global_op(chunk->code[offset])) continue;
+
+		int slot = chunk_operand(chunk, offset);
+		int limit = chunk_instruction_length(chunk, offset) == 4 ? OPERAND_LONG_MAX : UINT8_MAX;
+		if ((uint32_t)slot >= count) {
+			error = "global slot out of range";
+		} else if (slots[slot] > limit) {
+			error = "too many global variables";
+		} else {
+			chunk_set_operand(chunk, offset, slots[slot]);
+		}
+	}
+
+	FREE_ARRAY(int, slots, count);
+	return error;
+}
+#endif
+
+
+static const char* chunk_read(Chunk* chunk, Reader* reader) {
+	const uint8_t* magic = read_bytes(reader, 4);
+	if (magic == NULL || memcmp(magic, BYTECODE_MAGIC, 4) != 0)
+		return "not a bytecode file";
+	if (read_u8(reader) != BYTECODE_VERSION)
+		return "unsupported version";
+	uint8_t mismatched = read_u8(reader) ^ header_flags();
+	if (mismatched & FLAG_GLOBAL_SLOTS)
+		return "compiled for a different global mode";
+	if (mismatched & FLAG_OPTIMIZED)
+		return "compiled with a different -O setting";
+	if (read_u8(reader) != OPCODE_COUNT)
+		return "compiled for a different instruction set";
+	read_u8(reader);
+
+	uint32_t code_count = read_count(reader, 1);
+	uint8_t* code = read_bytes(reader, code_count);
+	if (code == NULL) return reader->error;
+	if (reader->in_place) {
+		chunk->code = code;
+	} else {
+		chunk->code = CHUNK_ALLOCATE(chunk, uint8_t, code_count);
+		memcpy(chunk->code, code, code_count);
+	}
+	chunk->capacity = chunk->count = (int)code_count;
+
+	uint32_t line_count = read_count(reader, 8);
+	chunk->lines = CHUNK_ALLOCATE(chunk, LineStart, line_count);
+	chunk->line_capacity = chunk->line_count = (int)line_count;
+	for (uint32_t i = 0; i < line_count; i++) {
+		chunk->lines[i].offset = (int)read_u32(reader);
+		chunk->lines[i].line = (int)read_u32(reader);
+	}
+
+	uint32_t constant_count = read_count(reader, 1);
+	for (uint32_t i = 0; i < constant_count && reader->error == NULL; i++) {
+		switch (read_u8(reader)) {
+		case CONSTANT_NUMBER:
+			chunk_write_constant(chunk, VALUE_NUMBER(read_number(reader)));
+			break;
+		case CONSTANT_STRING: {
+			ObjString* string = read_string(reader);
+			if (string != NULL)
+				chunk_write_constant(chunk, VALUE_OBJECT(string));
+			break;
+		}
+		default:
+			return "unknown constant type";
+		}
+	}
+	if (reader->error != NULL) return reader->error;
+
+	const char* error = chunk_validate(chunk);
+	if (error != NULL) return error;
+
+#ifdef GLOBAL_SLOTS
+	error = globals_relink(chunk, reader);
+	if (error != NULL) return error;
+#endif
+
+	if (reader->position != reader->size)
+		return "trailing data";
+	return NULL;
+}
+
+
+// Returns NULL, or why the file was rejected; the caller decides whether
+// that is worth reporting.
+const char* bytecode_read(Chunk* chunk, uint8_t* data, size_t size, bool in_place) {
+	const char* error = NULL;
+	if (size < 4) {
+		error = "file too short";
+	} else {
+		uint32_t expected = 0;
+		for (int i = 0; i < 4; i++)
+			expected |= (uint32_t)data[size - 4 + i] << (8 * i);
+		if (checksum(data, size - 4) != expected)
+			error = "checksum mismatch";
+	}
+
+	if (error == NULL) {
+		Reader reader = {data, size - 4, 0, in_place, NULL};
+		vm.chunk = chunk;
+		error = chunk_read(chunk, &reader);
+	}
+
+	if (error != NULL) {
+		if (in_place) {
+			chunk->code = NULL;
+			chunk->capacity = 0;
+		}
+		chunk_free(chunk);
+		*chunk = chunk_create();
+	}
+	return error;
+}
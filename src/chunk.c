@@ -1,7 +1,13 @@
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
+#include "vm.h"
 #include <stdint.h>
+#include <string.h>
+
+
+extern VM vm;
 
 
 Chunk chunk_create() {
@@ -10,7 +16,12 @@ Chunk chunk_create() {
 	chunk.capacity = 0;
 	chunk.code = NULL;
 	chunk.constants = value_array_create();
+	chunk.line_count = 0;
+	chunk.line_capacity = 0;
 	chunk.lines = NULL;
+#ifdef CHUNK_ARENA
+	chunk.arena = arena_create();
+#endif
 	return chunk;
 }
 
@@ -19,27 +30,230 @@ void chunk_write(Chunk *chunk, uint8_t byte, int line) {
 	if (chunk->capacity < chunk->count + 1) {
 		int old_capacity = chunk->capacity;
 		chunk->capacity = GROW_CAPACITY(old_capacity);
-		chunk->code = GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
-		chunk->lines = GROW_ARRAY(int, chunk->lines, old_capacity, chunk->capacity);
+		chunk->code = CHUNK_GROW_ARRAY(chunk, uint8_t, chunk->code, old_capacity, chunk->capacity);
 	}
 
 	chunk->code[chunk->count] = byte;
-	chunk->lines[chunk->count] = line;
 	chunk->count++;
+
+	if (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].line == line)
+		return;
+
+	if (chunk->line_capacity < chunk->line_count + 1) {
+		int old_capacity = chunk->line_capacity;
+		chunk->line_capacity = GROW_CAPACITY(old_capacity);
+		chunk->lines = CHUNK_GROW_ARRAY(chunk, LineStart, chunk->lines, old_capacity, chunk->line_capacity);
+	}
+
+	LineStart* start = &chunk->lines[chunk->line_count++];
+	start->offset = chunk->count - 1;
+	start->line = line;
 }
 
 
 void chunk_free(Chunk *chunk) {
+	if (vm.chunk == chunk)
+		vm.chunk = NULL;
+#ifdef CHUNK_ARENA
+	arena_free(&chunk->arena);
+	chunk->constants = value_array_create();
+#else
 	FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-	FREE_ARRAY(int, chunk->lines, chunk->capacity);
+	FREE_ARRAY(LineStart, chunk->lines, chunk->line_capacity);
+	value_array_free(&chunk->constants);
+#endif
 	chunk->code = NULL;
 	chunk->count = 0;
 	chunk->capacity = 0;
-	value_array_free(&chunk->constants);
+	chunk->lines = NULL;
+	chunk->line_count = 0;
+	chunk->line_capacity = 0;
+}
+
+
+void* chunk_reallocate(Chunk* chunk, void* pointer, size_t old_size, size_t new_size) {
+#ifdef CHUNK_ARENA
+	return arena_reallocate(&chunk->arena, pointer, old_size, new_size);
+#else
+	return reallocate(pointer, old_size, new_size);
+#endif
+}
+
+
+void chunk_truncate(Chunk* chunk, int count) {
+	chunk->count = count;
+	while (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].offset >= count)
+		chunk->line_count--;
+}
+
+
+int chunk_get_line(Chunk* chunk, int offset) {
+	int low = 0;
+	int high = chunk->line_count - 1;
+	while (low < high) {
+		int middle = low + (high - low + 1) / 2;
+		if (chunk->lines[middle].offset > offset) {
+			high = middle - 1;
+		} else {
+			low = middle;
+		}
+	}
+	return chunk->lines[low].line;
 }
 
 
 int chunk_write_constant(Chunk *chunk, Value value) {
-	value_array_write(&chunk->constants, value);
-	return chunk->constants.count - 1;
+	ValueArray* constants = &chunk->constants;
+	if (constants->capacity < constants->count + 1) {
+		int old_capacity = constants->capacity;
+		constants->capacity = GROW_CAPACITY(old_capacity);
+		vm_push(value);
+		constants->values = CHUNK_GROW_ARRAY(chunk, Value, constants->values, old_capacity, constants->capacity);
+		vm_pop();
+	}
+
+	constants->values[constants->count] = value;
+	return constants->count++;
+}
+
+
+int chunk_instruction_length(Chunk* chunk, int offset) {
+	switch (chunk->code[offset]) {
+	case OP_CONSTANT:
+	case OP_DEFINE_GLOBAL:
+	case OP_GET_GLOBAL:
+	case OP_SET_GLOBAL:
+	case OP_ADD_CONSTANT:
+	case OP_EQUAL_CONSTANT:
+	case OP_GREATER_CONSTANT:
+	case OP_LESS_CONSTANT:
+	case OP_SET_GLOBAL_POP:
+	case OP_ADD_CONSTANT_NUM:
+	case OP_ADD_CONSTANT_STR:
+	case OP_NOT_EQUAL_CONSTANT:
+	case OP_NOT_GREATER_CONSTANT:
+	case OP_NOT_LESS_CONSTANT:
+		return 2;
+	case OP_CONSTANT_LONG:
+	case OP_DEFINE_GLOBAL_LONG:
+	case OP_GET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_POP_LONG:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+
+int chunk_operand(Chunk* chunk, int offset) {
+	const uint8_t* operand = &chunk->code[offset + 1];
+	if (chunk_instruction_length(chunk, offset) == 4)
+		return operand[0] | operand[1] << 8 | operand[2] << 16;
+	return operand[0];
+}
+
+
+void chunk_set_operand(Chunk* chunk, int offset, int operand) {
+	uint8_t* code = &chunk->code[offset + 1];
+	code[0] = (uint8_t)operand;
+	if (chunk_instruction_length(chunk, offset) == 4) {
+		code[1] = (uint8_t)(operand >> 8);
+		code[2] = (uint8_t)(operand >> 16);
+	}
+}
+
+
+ConstantCache constant_cache_create() {
+	ConstantCache cache;
+	cache.count = 0;
+	cache.capacity = 0;
+	cache.indices = NULL;
+	return cache;
+}
+
+
+void constant_cache_free(ConstantCache* cache) {
+	FREE_ARRAY(int, cache->indices, cache->capacity);
+	*cache = constant_cache_create();
+}
+
+
+static uint32_t constant_hash(Value value) {
+	if (IS_STRING(value))
+		return AS_STRING(value)->hash;
+
+	double number = AS_NUMBER(value);
+	uint64_t bits;
+	memcpy(&bits, &number, sizeof(double));
+	bits *= 0x9e3779b97f4a7c15u;
+	return (uint32_t)(bits >> 32);
+}
+
+
+// Strings are interned, and numbers must match bit for bit so that 0 and -0
+// stay apart.
+static bool constant_same(Value a, Value b) {
+	if (IS_STRING(a) || IS_STRING(b))
+		return IS_STRING(a) && IS_STRING(b) && AS_STRING(a) == AS_STRING(b);
+
+	double x = AS_NUMBER(a);
+	double y = AS_NUMBER(b);
+	return memcmp(&x, &y, sizeof(double)) == 0;
+}
+
+
+static int* constant_cache_slot(Chunk* chunk, ConstantCache* cache, Value value) {
+	uint32_t mask = (uint32_t)cache->capacity - 1;
+	for (uint32_t index = constant_hash(value) & mask;; index = (index + 1) & mask) {
+		int* slot = &cache->indices[index];
+		if (*slot < 0 || constant_same(chunk->constants.values[*slot], value))
+			return slot;
+	}
+}
+
+
+static void constant_cache_register(Chunk* chunk, ConstantCache* cache, int constant) {
+	int* slot = constant_cache_slot(chunk, cache, chunk->constants.values[constant]);
+	if (*slot < 0)
+		*slot = constant;
+}
+
+
+static void constant_cache_reserve(Chunk* chunk, ConstantCache* cache, int count) {
+	if (count * 2 <= cache->capacity)
+		return;
+
+	int capacity = cache->capacity;
+	while (count * 2 > capacity)
+		capacity = GROW_CAPACITY(capacity);
+
+	int* indices = ALLOCATE(int, capacity);
+	for (int i = 0; i < capacity; i++)
+		indices[i] = -1;
+	FREE_ARRAY(int, cache->indices, cache->capacity);
+	cache->indices = indices;
+	cache->capacity = capacity;
+
+	for (int i = 0; i < cache->count; i++)
+		constant_cache_register(chunk, cache, i);
+}
+
+
+// Returns the index of an equal constant, writing the value only if the
+// chunk has none yet. Constants written to the chunk directly are picked up
+// on the next call.
+int chunk_add_constant(Chunk* chunk, ConstantCache* cache, Value value) {
+	vm_push(value);
+	constant_cache_reserve(chunk, cache, chunk->constants.count + 1);
+	vm_pop();
+	while (cache->count < chunk->constants.count)
+		constant_cache_register(chunk, cache, cache->count++);
+
+	int* slot = constant_cache_slot(chunk, cache, value);
+	if (*slot < 0) {
+		*slot = chunk_write_constant(chunk, value);
+		cache->count = chunk->constants.count;
+	}
+	return *slot;
 }
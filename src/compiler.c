@@ -3,10 +3,10 @@
 #include "object.h"
 #include "scanner.h"
 #include "value.h"
-
-#ifdef DEBUG_PRINT_CODE
+#include "vm.h"
 #include "debug.h"
-#endif
+#include "optimizer.h"
+#include "options.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -46,10 +46,17 @@ typedef struct {
 } ParseRule;
 
 
+extern Options options;
+extern VM vm;
+
 Parser parser;
 
 Chunk* compiling_chunk;
 
+ConstantCache constants;
+
+int last_assignment;
+
 static Chunk* current_chunk() {
 	return compiling_chunk;
 }
@@ -127,6 +134,18 @@ static void emit_bytes(uint8_t byte_1, uint8_t byte_2) {
 }
 
 
+static void emit_operand(OpCode op, OpCode op_long, int operand) {
+	if (operand <= UINT8_MAX) {
+		emit_bytes(op, (uint8_t)operand);
+		return;
+	}
+	emit_byte(op_long);
+	emit_byte((uint8_t)operand);
+	emit_byte((uint8_t)(operand >> 8));
+	emit_byte((uint8_t)(operand >> 16));
+}
+
+
 static void emit_return() {
 	emit_byte(OP_RETURN);
 }
@@ -134,26 +153,24 @@ static void emit_return() {
 
 static void compiler_end() {
 	emit_return();
-	#ifdef DEBUG_PRINT_CODE
-	if (!parser.had_error)
+	if (options.dump_bytecode && !parser.had_error)
 		disassemble_chunk(current_chunk(), "code");
-	#endif
 }
 
 
-static uint8_t make_constant(Value value) {
-	int constant = chunk_write_constant(current_chunk(), value);
-	if (constant > UINT8_MAX) {
-		error("Too many constant in one chunk.");
+static int make_constant(Value value) {
+	int constant = chunk_add_constant(current_chunk(), &constants, value);
+	if (constant > OPERAND_LONG_MAX) {
+		error("Too many constants in one chunk.");
 		return 0;
 	}
 
-	return (uint8_t)constant;
+	return constant;
 }
 
 
 static void emit_constant(Value value) {
-	emit_bytes(OP_CONSTANT, make_constant(value));
+	emit_operand(OP_CONSTANT, OP_CONSTANT_LONG, make_constant(value));
 }
 
 
@@ -180,17 +197,26 @@ static void synchronize() {
 }
 
 
-static uint8_t identifier_constant(Token* name) {
+static int identifier_global(Token* name) {
+#ifdef GLOBAL_SLOTS
+	int slot = vm_global_slot(string_copy(name->start, name->length));
+	if (slot > OPERAND_LONG_MAX) {
+		error("Too many global variables.");
+		return 0;
+	}
+	return slot;
+#else
 	return make_constant(VALUE_OBJECT(string_copy(name->start, name->length)));
+#endif
 }
 
-static uint8_t variable_parse(const char* error) {
+static int variable_parse(const char* error) {
 	consume(TOKEN_IDENTIFIER, error);
-	return identifier_constant(&parser.previous);
+	return identifier_global(&parser.previous);
 }
 
-static void variable_define(uint8_t global) {
-	emit_bytes(OP_DEFINE_GLOBAL, global);
+static void variable_define(int global) {
+	emit_operand(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
 }
 
 
@@ -203,13 +229,14 @@ static void declaration();
 
 
 static void variable_named(Token name, bool can_assign) {
-	uint8_t arg = identifier_constant(&name);
+	int arg = identifier_global(&name);
 
 	if (can_assign && match(TOKEN_EQUAL)) {
 		expression();
-		emit_bytes(OP_SET_GLOBAL, arg);
+		last_assignment = current_chunk()->count;
+		emit_operand(OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, arg);
 	} else {
-		emit_bytes(OP_GET_GLOBAL, arg);
+		emit_operand(OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, arg);
 	}
 }
 
@@ -241,7 +268,7 @@ static void expression() {
 
 
 static void declaration_var() {
-	uint8_t global = variable_parse("Expect variable name");
+	int global = variable_parse("Expect variable name");
 
 	if (match(TOKEN_EQUAL)) {
 		expression();
@@ -269,7 +296,14 @@ static void declaration() {
 static void expression_statement() {
 	expression();
 	consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-	emit_byte(OP_POP);
+
+	Chunk* chunk = current_chunk();
+	if (last_assignment >= 0 && last_assignment == chunk->count - chunk_instruction_length(chunk, last_assignment)) {
+		uint8_t* code = &chunk->code[last_assignment];
+		*code = *code == OP_SET_GLOBAL_LONG ? OP_SET_GLOBAL_POP_LONG : OP_SET_GLOBAL_POP;
+	} else {
+		emit_byte(OP_POP);
+	}
 }
 
 static void statement() {
@@ -309,22 +343,33 @@ static void unary(bool can_assign) {
 }
 
 
+static void emit_binary(int operand, OpCode op, OpCode op_constant) {
+	Chunk* chunk = current_chunk();
+	if (chunk->count == operand + 2 && chunk->code[operand] == OP_CONSTANT) {
+		chunk->code[operand] = op_constant;
+	} else {
+		emit_byte(op);
+	}
+}
+
+
 static void binary(bool can_assign) {
 	TokenType operator = parser.previous.type;
 	ParseRule* rule = parse_rule_get(operator);
+	int operand = current_chunk()->count;
 	parse_precedence((Precedence)(rule->precedence + 1));
 
 	switch (operator) {
-	case TOKEN_PLUS: emit_byte(OP_ADD); break;
+	case TOKEN_PLUS: emit_binary(operand, OP_ADD, OP_ADD_CONSTANT); break;
 	case TOKEN_MINUS: emit_byte(OP_SUBTRACT); break;
 	case TOKEN_STAR: emit_byte(OP_MULTIPLY); break;
 	case TOKEN_SLASH: emit_byte(OP_DIVIDE); break;
-	case TOKEN_BANG_EQUAL: emit_bytes(OP_EQUAL, OP_NOT); break;
-	case TOKEN_EQUAL_EQUAL: emit_byte(OP_EQUAL); break;
-	case TOKEN_GREATER: emit_byte(OP_GREATER); break;
-	case TOKEN_GREATER_EQUAL: emit_bytes(OP_LESS, OP_NOT); break;
-	case TOKEN_LESS: emit_byte(OP_LESS); break;
-	case TOKEN_LESS_EQUAL: emit_bytes(OP_GREATER, OP_NOT); break;
+	case TOKEN_BANG_EQUAL: emit_binary(operand, OP_EQUAL, OP_EQUAL_CONSTANT); emit_byte(OP_NOT); break;
+	case TOKEN_EQUAL_EQUAL: emit_binary(operand, OP_EQUAL, OP_EQUAL_CONSTANT); break;
+	case TOKEN_GREATER: emit_binary(operand, OP_GREATER, OP_GREATER_CONSTANT); break;
+	case TOKEN_GREATER_EQUAL: emit_binary(operand, OP_LESS, OP_LESS_CONSTANT); emit_byte(OP_NOT); break;
+	case TOKEN_LESS: emit_binary(operand, OP_LESS, OP_LESS_CONSTANT); break;
+	case TOKEN_LESS_EQUAL: emit_binary(operand, OP_GREATER, OP_GREATER_CONSTANT); emit_byte(OP_NOT); break;
 	default: return;
 	}
 }
@@ -406,6 +451,9 @@ static void parse_precedence(Precedence precedence) {
 bool compile(const char *source, Chunk* chunk) {
 	scanner_init(source);
 	compiling_chunk = chunk;
+	constants = constant_cache_create();
+	vm.chunk = chunk;
+	last_assignment = -1;
 	parser.had_error = false;
 	parser.panic_mode = false;
 
@@ -416,6 +464,15 @@ bool compile(const char *source, Chunk* chunk) {
 	}
 
 	compiler_end();
-	return !parser.had_error;
+	constant_cache_free(&constants);
+	if (parser.had_error)
+		return false;
+
+	if (options.optimize) {
+		chunk_optimize(chunk);
+		if (options.dump_bytecode)
+			disassemble_chunk(chunk, "optimized");
+	}
+	return true;
 }
 
@@ -1,10 +1,60 @@
 #include "debug.h"
 #include "chunk.h"
+#include "object.h"
 #include "value.h"
+#include "vm.h"
 
 #include <stdint.h>
 #include <stdio.h>
 
+
+static const char* opcode_names[] = {
+	[OP_RETURN] = "OP_RETURN",
+	[OP_CONSTANT] = "OP_CONSTANT",
+	[OP_NIL] = "OP_NIL",
+	[OP_TRUE] = "OP_TRUE",
+	[OP_FALSE] = "OP_FALSE",
+	[OP_NEGATE] = "OP_NEGATE",
+	[OP_NOT] = "OP_NOT",
+	[OP_ADD] = "OP_ADD",
+	[OP_SUBTRACT] = "OP_SUBTRACT",
+	[OP_MULTIPLY] = "OP_MULTIPLY",
+	[OP_DIVIDE] = "OP_DIVIDE",
+	[OP_EQUAL] = "OP_EQUAL",
+	[OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+	[OP_GREATER] = "OP_GREATER",
+	[OP_LESS] = "OP_LESS",
+	[OP_PRINT] = "OP_PRINT",
+	[OP_POP] = "OP_POP",
+	[OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+	[OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+	[OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+	[OP_ADD_CONSTANT] = "OP_ADD_CONSTANT",
+	[OP_EQUAL_CONSTANT] = "OP_EQUAL_CONSTANT",
+	[OP_GREATER_CONSTANT] = "OP_GREATER_CONSTANT",
+	[OP_LESS_CONSTANT] = "OP_LESS_CONSTANT",
+	[OP_SET_GLOBAL_POP] = "OP_SET_GLOBAL_POP",
+	[OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+	[OP_DEFINE_GLOBAL_LONG] = "OP_DEFINE_GLOBAL_LONG",
+	[OP_GET_GLOBAL_LONG] = "OP_GET_GLOBAL_LONG",
+	[OP_SET_GLOBAL_LONG] = "OP_SET_GLOBAL_LONG",
+	[OP_SET_GLOBAL_POP_LONG] = "OP_SET_GLOBAL_POP_LONG",
+	[OP_ADD_NUM] = "OP_ADD_NUM",
+	[OP_ADD_STR] = "OP_ADD_STR",
+	[OP_ADD_CONSTANT_NUM] = "OP_ADD_CONSTANT_NUM",
+	[OP_ADD_CONSTANT_STR] = "OP_ADD_CONSTANT_STR",
+	[OP_NOT_EQUAL_CONSTANT] = "OP_NOT_EQUAL_CONSTANT",
+	[OP_NOT_GREATER_CONSTANT] = "OP_NOT_GREATER_CONSTANT",
+	[OP_NOT_LESS_CONSTANT] = "OP_NOT_LESS_CONSTANT",
+};
+
+
+const char* opcode_name(uint8_t instruction) {
+	if (instruction >= OPCODE_COUNT) return NULL;
+	return opcode_names[instruction];
+}
+
+
 void disassemble_chunk(Chunk *chunk, const char *name) {
 	printf("== %s ==\n", name);
 
@@ -20,68 +70,64 @@ static int instruction_simple(const char* name, int offset) {
 }
 
 static int instruction_constant(const char* name, Chunk* chunk, int offset) {
-	uint8_t constant = chunk->code[offset + 1];
-	printf("%-16s %4d '", name, constant);
+	int constant = chunk_operand(chunk, offset);
+	printf("%-20s %4d '", name, constant);
 	value_print(chunk->constants.values[constant]);
 	printf("'\n");
-	return offset + 2;
+	return offset + chunk_instruction_length(chunk, offset);
+}
+
+static int instruction_global(const char* name, Chunk* chunk, int offset) {
+#ifdef GLOBAL_SLOTS
+	int slot = chunk_operand(chunk, offset);
+	printf("%-20s %4d '%s'\n", name, slot, vm_global_name(slot)->chars);
+	return offset + chunk_instruction_length(chunk, offset);
+#else
+	return instruction_constant(name, chunk, offset);
+#endif
 }
 
 
 int disassemble_instruction(Chunk *chunk, int offset) {
 	printf("%04d ", offset);
 
-	if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+	int line = chunk_get_line(chunk, offset);
+	if (offset > 0 && line == chunk_get_line(chunk, offset - 1)) {
 		printf("   | ");
 	} else {
-		printf("%4d ", chunk->lines[offset]);
+		printf("%4d ", line);
 	}
 
 	uint8_t instruction = chunk->code[offset];
+	const char* name = opcode_name(instruction);
 
 	switch (instruction) {
-	case OP_RETURN:
-		return instruction_simple("OP_RETURN", offset);
 	case OP_CONSTANT:
-		return instruction_constant("OP_CONSTANT", chunk, offset);
-	case OP_NEGATE:
-		return instruction_simple("OP_NEGATE", offset);
-	case OP_ADD:
-		return instruction_simple("OP_ADD", offset);
-	case OP_SUBTRACT:
-		return instruction_simple("OP_SUBTRACT", offset);
-	case OP_MULTIPLY:
-		return instruction_simple("OP_MULTIPLY", offset);
-	case OP_DIVIDE:
-		return instruction_simple("OP_DIVIDE", offset);
-	case OP_NIL:
-		return instruction_simple("OP_NIL", offset);
-	case OP_TRUE:
-		return instruction_simple("OP_TRUE", offset);
-	case OP_FALSE:
-		return instruction_simple("OP_FALSE", offset);
-	case OP_NOT:
-		return instruction_simple("OP_NOT", offset);
-	case OP_EQUAL:
-		return instruction_simple("OP_EQUAL", offset);
-	case OP_LESS:
-		return instruction_simple("OP_LESS", offset);
-	case OP_GREATER:
-		return instruction_simple("OP_GREATER", offset);
-	case OP_PRINT:
-		return instruction_simple("OP_PRINT", offset);
-	case OP_POP:
-		return instruction_simple("OP_POP", offset);
+	case OP_CONSTANT_LONG:
+	case OP_ADD_CONSTANT:
+	case OP_ADD_CONSTANT_NUM:
+	case OP_ADD_CONSTANT_STR:
+	case OP_EQUAL_CONSTANT:
+	case OP_GREATER_CONSTANT:
+	case OP_LESS_CONSTANT:
+	case OP_NOT_EQUAL_CONSTANT:
+	case OP_NOT_GREATER_CONSTANT:
+	case OP_NOT_LESS_CONSTANT:
+		return instruction_constant(name, chunk, offset);
 	case OP_DEFINE_GLOBAL:
-		return instruction_constant("OP_DEFINE_GLOBAL", chunk, offset);
 	case OP_GET_GLOBAL:
-		return instruction_constant("OP_GET_GLOBAL", chunk, offset);
 	case OP_SET_GLOBAL:
-		return instruction_constant("OP_SET_GLOBAL", chunk, offset);
+	case OP_SET_GLOBAL_POP:
+	case OP_DEFINE_GLOBAL_LONG:
+	case OP_GET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_POP_LONG:
+		return instruction_global(name, chunk, offset);
 	default:
-		printf("Unknown opcode %d\n", instruction);
-		return offset + 1;
+		if (name == NULL) {
+			printf("Unknown opcode %d\n", instruction);
+			return offset + 1;
+		}
+		return instruction_simple(name, offset);
 	}
 }
-
-
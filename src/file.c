@@ -1,47 +1,262 @@
 #include "file.h"
+#include "bytecode.h"
+#include "chunk.h"
 #include "common.h"
+#include "compiler.h"
+#include "options.h"
 #include "vm.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
-static char* file_read(const char* path) {
-	FILE* file = fopen(path, "rb");
-	if (file == NULL) {
+#ifdef FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+// Modification times with sub-second precision, so a source edited within
+// the second after --compile still counts as newer than its cache.
+#if defined(__APPLE__)
+#define STAT_MTIME(file_stat) ((file_stat).st_mtimespec)
+#else
+#define STAT_MTIME(file_stat) ((file_stat).st_mtim)
+#endif
+
+
+extern Options options;
+
+
+typedef struct {
+	char* data;
+	size_t size;
+	size_t mapped;
+} FileData;
+
+
+#ifdef FILE_MMAP
+static bool file_map(FileData* file, const char* path) {
+	int descriptor = open(path, O_RDONLY);
+	if (descriptor < 0)
+		return false;
+
+	struct stat file_stat;
+	if (fstat(descriptor, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0) {
+		close(descriptor);
+		return false;
+	}
+
+	size_t size = (size_t)file_stat.st_size;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t mapped = (size + 1 + page - 1) / page * page;
+
+	char* region = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		close(descriptor);
+		return false;
+	}
+
+	char* data = mmap(region, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, descriptor, 0);
+	close(descriptor);
+	if (data == MAP_FAILED) {
+		munmap(region, mapped);
+		return false;
+	}
+
+	file->data = data;
+	file->size = size;
+	file->mapped = mapped;
+	return true;
+}
+#endif
+
+
+static FileData file_read(const char* path) {
+	FileData file;
+#ifdef FILE_MMAP
+	if (file_map(&file, path))
+		return file;
+#endif
+
+	FILE* handle = fopen(path, "rb");
+	if (handle == NULL) {
 		fprintf(stderr, "Could not open file \"%s\".\n", path);
 		exit(74);
 	}
-	fseek(file, 0L, SEEK_END);
+	fseek(handle, 0L, SEEK_END);
 
-	size_t file_size = ftell(file);
-	rewind(file);
+	size_t file_size = ftell(handle);
+	rewind(handle);
 
 	char* buffer = (char*)malloc(file_size + 1);
 	if (buffer == NULL) {
 		fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
 		exit(74);
 	}
-	size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+	size_t bytes_read = fread(buffer, sizeof(char), file_size, handle);
 	if (bytes_read < file_size) {
 		fprintf(stderr, "Could not read file \"%s\".\n", path);
 		exit(74);
 	}
 	buffer[bytes_read] = '\0';
 
-	fclose(file);
-	return buffer;
+	fclose(handle);
+	file.data = buffer;
+	file.size = bytes_read;
+	file.mapped = 0;
+	return file;
 }
 
 
-void file_run(const char *path) {
-	char* source = file_read(path);
-	InterpretResult result = vm_interpret(source);
-	free(source);
+static void file_close(FileData* file) {
+#ifdef FILE_MMAP
+	if (file->mapped != 0) {
+		munmap(file->data, file->mapped);
+		return;
+	}
+#endif
+	free(file->data);
+}
+
+
+static bool has_suffix(const char* path, const char* suffix) {
+	size_t length = strlen(path);
+	size_t suffix_length = strlen(suffix);
+	return length >= suffix_length && strcmp(path + length - suffix_length, suffix) == 0;
+}
+
+
+static char* cache_path(const char* path) {
+	const char* suffix = has_suffix(path, ".lox") ? "c" : ".loxc";
+	char* cache = malloc(strlen(path) + strlen(suffix) + 1);
+	if (cache == NULL) {
+		fprintf(stderr, "Not enough memory.\n");
+		exit(74);
+	}
+	strcpy(cache, path);
+	strcat(cache, suffix);
+	return cache;
+}
+
+
+static bool cache_is_fresh(const char* path, const char* cache) {
+	struct stat source_stat;
+	struct stat cache_stat;
+	if (stat(path, &source_stat) != 0 || stat(cache, &cache_stat) != 0)
+		return false;
+	struct timespec source_time = STAT_MTIME(source_stat);
+	struct timespec cache_time = STAT_MTIME(cache_stat);
+	if (cache_time.tv_sec != source_time.tv_sec)
+		return cache_time.tv_sec > source_time.tv_sec;
+	return cache_time.tv_nsec > source_time.tv_nsec;
+}
 
 
+static void result_exit(InterpretResult result) {
 	if (result == INTERPRET_COMPILE_ERROR)
 		exit(65);
 	if (result == INTERPRET_RUNTIME_ERROR)
 		exit(70);
 }
 
+
+// A mapped file backs the chunk's code, so it stays open until the chunk
+// has run.
+static const char* bytecode_load(Chunk* chunk, const char* path, FileData* file) {
+	*file = file_read(path);
+	bool in_place = file->mapped != 0;
+	const char* error = bytecode_read(chunk, (uint8_t*)file->data, file->size, in_place);
+
+	if (error != NULL || !in_place)
+		file_close(file);
+	return error;
+}
+
+
+static void bytecode_interpret(Chunk* chunk, FileData* file) {
+	InterpretResult result = vm_interpret_chunk(chunk);
+	if (file->mapped != 0) {
+		chunk->code = NULL;
+		chunk->capacity = 0;
+		file_close(file);
+	}
+	chunk_free(chunk);
+	result_exit(result);
+}
+
+
+static void file_compile(const char* path, const char* cache) {
+	FileData source = file_read(path);
+	Chunk chunk = chunk_create();
+	bool compiled = compile(source.data, &chunk);
+	file_close(&source);
+
+	if (!compiled)
+		exit(65);
+	bool written = bytecode_write(&chunk, cache);
+	chunk_free(&chunk);
+	if (!written) {
+		fprintf(stderr, "Could not write bytecode file \"%s\".\n", cache);
+		exit(74);
+	}
+}
+
+
+static void bytecode_run(const char* path) {
+	Chunk chunk = chunk_create();
+	FileData file;
+	const char* error = bytecode_load(&chunk, path, &file);
+	if (error != NULL) {
+		fprintf(stderr, "Invalid bytecode file \"%s\": %s.\n", path, error);
+		exit(65);
+	}
+	bytecode_interpret(&chunk, &file);
+}
+
+
+void file_run(const char *path) {
+	if (has_suffix(path, ".loxc")) {
+		bytecode_run(path);
+		return;
+	}
+
+	char* cache = cache_path(path);
+	if (options.compile) {
+		file_compile(path, cache);
+		free(cache);
+		return;
+	}
+
+	Chunk chunk = chunk_create();
+	FileData file;
+	if (cache_is_fresh(path, cache) && bytecode_load(&chunk, cache, &file) == NULL) {
+		free(cache);
+		bytecode_interpret(&chunk, &file);
+		return;
+	}
+
+	// A stale or rejected cache is a miss, not an error: run the source and
+	// quietly replace the cache so the next run can use it.
+	struct stat cache_stat;
+	bool stale = stat(cache, &cache_stat) == 0;
+	FileData source = file_read(path);
+	bool compiled = compile(source.data, &chunk);
+	file_close(&source);
+	if (!compiled) {
+		chunk_free(&chunk);
+		free(cache);
+		exit(65);
+	}
+	if (stale)
+		bytecode_write(&chunk, cache);
+	free(cache);
+
+	InterpretResult result = vm_interpret_chunk(&chunk);
+	chunk_free(&chunk);
+	result_exit(result);
+}
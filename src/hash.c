@@ -0,0 +1,105 @@
+#include "hash.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+#ifdef HASH_FNV
+uint32_t hash_bytes(const char* key, int length) {
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < length; i++) {
+		hash ^= (uint8_t)key[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+#else
+// A wyhash-style hash: 16 or 48 bytes per step through 64x64->128 bit
+// multiplies, with overlapping reads for the tail so no byte loop remains.
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+#define HASH_P3 0x589965cc75374cc3ull
+
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+	__uint128_t product = (__uint128_t)a * b;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+	uint64_t a_high = a >> 32, a_low = (uint32_t)a;
+	uint64_t b_high = b >> 32, b_low = (uint32_t)b;
+	uint64_t high = a_high * b_high;
+	uint64_t middle0 = a_high * b_low;
+	uint64_t middle1 = b_high * a_low;
+	uint64_t low = a_low * b_low;
+
+	uint64_t partial = low + (middle0 << 32);
+	uint64_t carry = partial < low;
+	uint64_t result_low = partial + (middle1 << 32);
+	carry += result_low < partial;
+	uint64_t result_high = high + (middle0 >> 32) + (middle1 >> 32) + carry;
+	return result_low ^ result_high;
+#endif
+}
+
+
+static inline uint64_t read64(const uint8_t* bytes) {
+	uint64_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+
+static inline uint64_t read32(const uint8_t* bytes) {
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+
+uint32_t hash_bytes(const char* key, int length) {
+	const uint8_t* bytes = (const uint8_t*)key;
+	size_t remaining = (size_t)length;
+	uint64_t seed = HASH_P0;
+	uint64_t a;
+	uint64_t b;
+
+	if (remaining <= 16) {
+		if (remaining >= 4) {
+			size_t middle = (remaining >> 3) << 2;
+			a = (read32(bytes) << 32) | read32(bytes + middle);
+			b = (read32(bytes + remaining - 4) << 32) | read32(bytes + remaining - 4 - middle);
+		} else if (remaining > 0) {
+			a = ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[remaining >> 1] << 8) | bytes[remaining - 1];
+			b = 0;
+		} else {
+			a = 0;
+			b = 0;
+		}
+	} else {
+		if (remaining > 48) {
+			uint64_t seed1 = seed;
+			uint64_t seed2 = seed;
+			do {
+				seed = hash_mix(read64(bytes) ^ HASH_P1, read64(bytes + 8) ^ seed);
+				seed1 = hash_mix(read64(bytes + 16) ^ HASH_P2, read64(bytes + 24) ^ seed1);
+				seed2 = hash_mix(read64(bytes + 32) ^ HASH_P3, read64(bytes + 40) ^ seed2);
+				bytes += 48;
+				remaining -= 48;
+			} while (remaining > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (remaining > 16) {
+			seed = hash_mix(read64(bytes) ^ HASH_P1, read64(bytes + 8) ^ seed);
+			bytes += 16;
+			remaining -= 16;
+		}
+		a = read64(bytes + remaining - 16);
+		b = read64(bytes + remaining - 8);
+	}
+
+	uint64_t hash = hash_mix(HASH_P1 ^ (uint64_t)length, hash_mix(a ^ HASH_P1, b ^ seed));
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+#endif
@@ -1,21 +1,42 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "file.h"
+#include "memory.h"
+#include "options.h"
+#include "profile.h"
 #include "repl.h"
 #include "vm.h"
 
+extern VM vm;
+extern Options options;
+
 int main(int argc, char* argv[]) {
+	int arg = options_parse(argc, argv);
+	if (arg < 0 || argc - arg > 1) {
+		fprintf(stderr, "Usage: clox [-O] [--compile] [--trace] [--dump-bytecode] [--profile[=folded]] [--profile-pairs] [--mem-stats] [--gc-stress] [--gc-log] [--gc-growth=factor] [--gc-incremental] [--gc-step=work] [--quicken-stats] [path]\n");
+		return 64;
+	}
+
 	vm_create();
+	if (vm.profiling)
+		atexit(profile_report);
+	if (options.mem_stats)
+		atexit(memory_report);
+	if (options.gc_log)
+		atexit(gc_report);
+#ifdef QUICKENING
+	if (options.quicken_stats)
+		atexit(quicken_report);
+#endif
 
-	if (argc == 1) {
+	if (arg == argc) {
+		profile_skip_lines();
 		repl();
-	} else if (argc == 2) {
-		file_run(argv[1]);
 	} else {
-		fprintf(stderr, "Usage: clox [path]\n");
+		file_run(argv[arg]);
 	}
 
 	return 0;
 }
-
@@ -1,34 +1,436 @@
 #include "memory.h"
+#include "options.h"
+#include "table.h"
 #include "vm.h"
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "object.h"
 
 extern VM vm;
+extern Options options;
 
-void* reallocate(void *pointer, size_t old_size, size_t new_size) {
-	if (new_size == 0) {
-		free(pointer);
-		return NULL;
+#define POOL_GRANULE 16
+#define POOL_CLASS_COUNT 16
+#define POOL_MAX_SIZE (POOL_GRANULE * POOL_CLASS_COUNT)
+#define POOL_SLAB_SIZE (16 * 1024)
+#define LARGE_CLASS POOL_CLASS_COUNT
+
+
+typedef struct {
+	size_t bytes_peak;
+	uint64_t allocations[POOL_CLASS_COUNT + 1];
+	uint64_t live[POOL_CLASS_COUNT + 1];
+} MemoryStats;
+
+
+typedef struct {
+	uint64_t collections;
+	uint64_t pauses;
+	uint64_t bytes_freed;
+	uint64_t pause_total;
+	uint64_t pause_max;
+	size_t cycle_start;
+	size_t cycle_freed;
+	int cycle_steps;
+	uint64_t cycle_pause_max;
+} GCStats;
+
+static MemoryStats stats;
+static GCStats gc_stats;
+static bool collecting = false;
+
+
+static int size_class(void* pointer, size_t size) {
+	if (pointer == NULL && size == 0) return -1;
+	return size <= POOL_MAX_SIZE ? (int)((size - 1) / POOL_GRANULE) : LARGE_CLASS;
+}
+
+
+static void stats_update(int old_class, int new_class, size_t old_size, size_t new_size) {
+	vm.bytes_allocated += new_size - old_size;
+	if (vm.bytes_allocated > stats.bytes_peak)
+		stats.bytes_peak = vm.bytes_allocated;
+
+	if (old_class == new_class) return;
+	if (old_class >= 0)
+		stats.live[old_class]--;
+	if (new_class >= 0) {
+		stats.live[new_class]++;
+		stats.allocations[new_class]++;
 	}
+}
+
 
-	void* result = realloc(pointer, new_size);
+#ifdef OBJECT_POOL
+typedef struct PoolCell {
+	struct PoolCell* next;
+} PoolCell;
+
+typedef struct PoolSlab {
+	struct PoolSlab* next;
+} PoolSlab;
+
+static PoolCell* free_cells[POOL_CLASS_COUNT];
+static PoolSlab* slabs = NULL;
+
+
+static void* pool_allocate(int size_class) {
+	PoolCell* cell = free_cells[size_class];
+	if (cell == NULL) {
+		PoolSlab* slab = malloc(POOL_SLAB_SIZE);
+		if (slab == NULL)
+			exit(1);
+		slab->next = slabs;
+		slabs = slab;
+
+		size_t cell_size = (size_t)(size_class + 1) * POOL_GRANULE;
+		uint8_t* cells = (uint8_t*)slab + POOL_GRANULE;
+		for (size_t i = (POOL_SLAB_SIZE - POOL_GRANULE) / cell_size; i-- > 0;) {
+			PoolCell* free_cell = (PoolCell*)(cells + i * cell_size);
+			free_cell->next = cell;
+			cell = free_cell;
+		}
+	}
+
+	free_cells[size_class] = cell->next;
+	return cell;
+}
+
+
+static void pool_release(void* pointer, int size_class) {
+	PoolCell* cell = (PoolCell*)pointer;
+	cell->next = free_cells[size_class];
+	free_cells[size_class] = cell;
+}
+#endif
+
+
+static void* checked_realloc(void* pointer, size_t size) {
+	void* result = realloc(pointer, size);
 	if (result == NULL)
 		exit(1);
+	return result;
+}
+
 
+void* reallocate(void *pointer, size_t old_size, size_t new_size) {
+	int old_class = size_class(pointer, old_size);
+	int new_class = new_size == 0 ? -1 : size_class(NULL, new_size);
+	stats_update(old_class, new_class, old_size, new_size);
+
+	if (new_size > old_size && !collecting) {
+		if (vm.gc_state != GC_IDLE || options.gc_stress || vm.bytes_allocated > vm.next_gc) {
+			if (options.gc_incremental) {
+				gc_step(options.gc_step);
+			} else {
+				gc_collect();
+			}
+		}
+	}
+
+#ifdef OBJECT_POOL
+	if (old_class == new_class && old_class != LARGE_CLASS)
+		return pointer;
+	if (old_class == LARGE_CLASS && new_class == LARGE_CLASS)
+		return checked_realloc(pointer, new_size);
+
+	void* result = NULL;
+	if (new_class == LARGE_CLASS) {
+		result = checked_realloc(NULL, new_size);
+	} else if (new_class >= 0) {
+		result = pool_allocate(new_class);
+	}
+
+	if (result != NULL && pointer != NULL)
+		memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+
+	if (old_class == LARGE_CLASS) {
+		free(pointer);
+	} else if (old_class >= 0) {
+		pool_release(pointer, old_class);
+	}
 	return result;
+#else
+	if (new_size == 0) {
+		free(pointer);
+		return NULL;
+	}
+	return checked_realloc(pointer, new_size);
+#endif
 }
 
 static void object_free(Obj* object) {
 	switch (object->type) {
 	case OBJ_STRING: {
 		ObjString* string = (ObjString*)object;
-		FREE_ARRAY(char, string->chars, string->length);
-		FREE(ObjString, object);
+		reallocate(object, STRING_SIZE(string->length), 0);
+		break;
+	}
+	case OBJ_ROPE:
+		reallocate(object, sizeof(ObjRope), 0);
+		break;
+	}
+}
+
+static uint64_t gc_clock() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+void gc_mark_object(Obj* object) {
+	if (object == NULL || IS_MARKED(object))
+		return;
+	object->is_marked = vm.gc_mark;
+
+	if (vm.gray_capacity < vm.gray_count + 1) {
+		vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
+		vm.gray_stack = (Obj**)realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
+		if (vm.gray_stack == NULL)
+			exit(1);
+	}
+	vm.gray_stack[vm.gray_count++] = object;
+}
+
+
+void gc_mark_value(Value value) {
+	if (IS_OBJECT(value))
+		gc_mark_object(AS_OBJECT(value));
+}
+
+
+static int mark_array(ValueArray* array, int from, size_t budget) {
+	int to = budget < (size_t)(array->count - from) ? from + (int)budget : array->count;
+	for (int i = from; i < to; i++)
+		gc_mark_value(array->values[i]);
+	return to;
+}
+
+
+static void blacken_object(Obj* object) {
+	switch (object->type) {
+	case OBJ_STRING:
+		break;
+	case OBJ_ROPE: {
+		ObjRope* rope = (ObjRope*)object;
+		gc_mark_value(rope->left);
+		gc_mark_value(rope->right);
+		gc_mark_object((Obj*)rope->flat);
 		break;
 	}
 	}
 }
 
+
+static size_t trace_references(size_t budget) {
+	size_t work = 0;
+	while (vm.gray_count > 0 && work < budget) {
+		blacken_object(vm.gray_stack[--vm.gray_count]);
+		work++;
+	}
+	return work;
+}
+
+
+static void gc_begin() {
+	vm.gc_state = GC_MARKING;
+	vm.gc_root = GC_ROOT_GLOBALS;
+	vm.gc_cursor = 0;
+	vm.gc_cursor_capacity = vm.globals.capacity;
+	gc_stats.cycle_start = vm.bytes_allocated;
+	gc_stats.cycle_freed = 0;
+	gc_stats.cycle_steps = 0;
+	gc_stats.cycle_pause_max = 0;
+
+	for (Value* slot = vm.stack; slot < vm.stack_top; slot++)
+		gc_mark_value(*slot);
+	if (vm.chunk != NULL)
+		mark_array(&vm.chunk->constants, 0, SIZE_MAX);
+}
+
+
+// The global roots are walked with a cursor between steps. Stores into them
+// go through GC_BARRIER, and a resized table is rescanned from the start.
+static size_t mark_globals(size_t budget) {
+	size_t work = 0;
+	while (vm.gc_root != GC_ROOT_DONE && work < budget) {
+		int from = vm.gc_cursor;
+		switch (vm.gc_root) {
+		case GC_ROOT_GLOBALS:
+			if (vm.globals.capacity != vm.gc_cursor_capacity) {
+				vm.gc_cursor_capacity = vm.globals.capacity;
+				from = 0;
+			}
+			vm.gc_cursor = table_mark(&vm.globals, from, budget - work);
+			if (vm.gc_cursor == vm.globals.capacity) {
+				vm.gc_root++;
+				vm.gc_cursor = 0;
+			}
+			break;
+#ifdef GLOBAL_SLOTS
+		case GC_ROOT_GLOBAL_VALUES:
+			vm.gc_cursor = mark_array(&vm.global_values, from, budget - work);
+			if (vm.gc_cursor == vm.global_values.count) {
+				vm.gc_root++;
+				vm.gc_cursor = 0;
+			}
+			break;
+		case GC_ROOT_GLOBAL_NAMES:
+			vm.gc_cursor = mark_array(&vm.global_names, from, budget - work);
+			if (vm.gc_cursor == vm.global_names.count) {
+				vm.gc_root++;
+				vm.gc_cursor = 0;
+			}
+			break;
+#endif
+		default:
+			vm.gc_root = GC_ROOT_DONE;
+			break;
+		}
+		work += vm.gc_cursor > from ? (size_t)(vm.gc_cursor - from) : 1;
+	}
+	return work;
+}
+
+
+static void gc_finish_marking() {
+	for (Value* slot = vm.stack; slot < vm.stack_top; slot++)
+		gc_mark_value(*slot);
+	if (vm.chunk != NULL)
+		mark_array(&vm.chunk->constants, 0, SIZE_MAX);
+	trace_references(SIZE_MAX);
+
+	vm.gc_state = GC_WEAK;
+	vm.gc_cursor = 0;
+	vm.gc_cursor_capacity = vm.strings.capacity;
+}
+
+
+static void compact_strings() {
+	int capacity = vm.strings.capacity;
+	int tombstones = vm.strings.tombstones;
+	if (table_compact(&vm.strings) && options.gc_log) {
+		fprintf(stderr, "-- gc: strings table %d -> %d entries, %d tombstones cleared\n",
+			capacity, vm.strings.capacity, tombstones);
+	}
+}
+
+
+static size_t sweep(size_t budget) {
+	size_t work = 0;
+	while (*vm.gc_sweep != NULL && work < budget) {
+		Obj* object = *vm.gc_sweep;
+		work++;
+		if (IS_MARKED(object)) {
+			vm.gc_sweep = &object->next;
+			continue;
+		}
+
+		*vm.gc_sweep = object->next;
+		size_t before = vm.bytes_allocated;
+		object_free(object);
+		gc_stats.cycle_freed += before - vm.bytes_allocated;
+	}
+	return work;
+}
+
+
+static void gc_end() {
+	vm.gc_state = GC_IDLE;
+	vm.gc_mark = !vm.gc_mark;
+	vm.next_gc = (size_t)(vm.bytes_allocated * options.gc_growth);
+	if (vm.next_gc < GC_HEAP_MIN)
+		vm.next_gc = GC_HEAP_MIN;
+
+	gc_stats.collections++;
+	gc_stats.bytes_freed += gc_stats.cycle_freed;
+}
+
+
+static void gc_log_cycle() {
+	fprintf(stderr, "-- gc: freed %zu bytes (%zu -> %zu), next at %zu, %d steps, max pause %.1f us\n",
+		gc_stats.cycle_freed, gc_stats.cycle_start, vm.bytes_allocated, vm.next_gc,
+		gc_stats.cycle_steps, gc_stats.cycle_pause_max / 1000.0);
+}
+
+
+// Advances the collector by about `budget` units of work: one gray object,
+// table entry or swept object each. Objects allocated while a cycle is
+// running carry the current mark, so they survive it.
+void gc_step(size_t budget) {
+	uint64_t start = gc_clock();
+	size_t work = 0;
+	collecting = true;
+
+	if (vm.gc_state == GC_IDLE)
+		gc_begin();
+
+	if (vm.gc_state == GC_MARKING) {
+		work += trace_references(budget);
+		work += mark_globals(budget - work);
+		work += trace_references(budget - work);
+		if (vm.gray_count == 0 && vm.gc_root == GC_ROOT_DONE)
+			gc_finish_marking();
+	}
+
+	if (vm.gc_state == GC_WEAK && work < budget) {
+		trace_references(SIZE_MAX);
+		int from = vm.gc_cursor;
+		if (vm.strings.capacity != vm.gc_cursor_capacity) {
+			vm.gc_cursor_capacity = vm.strings.capacity;
+			from = 0;
+		}
+		vm.gc_cursor = table_remove_white(&vm.strings, from, budget - work);
+		work += (size_t)(vm.gc_cursor - from);
+		if (vm.gc_cursor == vm.strings.capacity) {
+			compact_strings();
+			vm.gc_state = GC_SWEEPING;
+			vm.gc_sweep = &vm.objects;
+		}
+	}
+
+	if (vm.gc_state == GC_SWEEPING && work < budget) {
+		work += sweep(budget - work);
+		if (*vm.gc_sweep == NULL)
+			gc_end();
+	}
+
+	collecting = false;
+	uint64_t pause = gc_clock() - start;
+	gc_stats.pauses++;
+	gc_stats.cycle_steps++;
+	gc_stats.pause_total += pause;
+	if (pause > gc_stats.pause_max)
+		gc_stats.pause_max = pause;
+	if (pause > gc_stats.cycle_pause_max)
+		gc_stats.cycle_pause_max = pause;
+
+	if (vm.gc_state == GC_IDLE && options.gc_log)
+		gc_log_cycle();
+}
+
+
+void gc_collect() {
+	do {
+		gc_step(SIZE_MAX);
+	} while (vm.gc_state != GC_IDLE);
+}
+
+
+void gc_report() {
+	fprintf(stderr, "== gc ==\n");
+	fprintf(stderr, "%12llu collections\n", (unsigned long long)gc_stats.collections);
+	fprintf(stderr, "%12llu pauses\n", (unsigned long long)gc_stats.pauses);
+	fprintf(stderr, "%12llu bytes freed\n", (unsigned long long)gc_stats.bytes_freed);
+	fprintf(stderr, "%12.1f us total pause\n", gc_stats.pause_total / 1000.0);
+	fprintf(stderr, "%12.1f us max pause\n", gc_stats.pause_max / 1000.0);
+}
+
+
 void objects_free() {
 	Obj* object = vm.objects;
 	while (object != NULL) {
@@ -37,3 +439,43 @@ void objects_free() {
 		object = next;
 	}
 }
+
+
+void pools_free() {
+#ifdef OBJECT_POOL
+	PoolSlab* slab = slabs;
+	while (slab != NULL) {
+		PoolSlab* next = slab->next;
+		free(slab);
+		slab = next;
+	}
+	slabs = NULL;
+	memset(free_cells, 0, sizeof(free_cells));
+#endif
+}
+
+
+void memory_report() {
+	TableStats strings = table_stats(&vm.strings);
+	fprintf(stderr, "== strings ==\n");
+	fprintf(stderr, "%12d live of %d entries (%.1f%% load)\n", strings.live, strings.capacity,
+		strings.capacity > 0 ? 100.0 * strings.live / strings.capacity : 0.0);
+	fprintf(stderr, "%12d tombstones\n", strings.tombstones);
+	fprintf(stderr, "%12.2f average probe length\n", strings.average_probe);
+	fprintf(stderr, "%12d max probe length\n", strings.max_probe);
+
+	fprintf(stderr, "== memory ==\n");
+	fprintf(stderr, "%12zu bytes live\n", vm.bytes_allocated);
+	fprintf(stderr, "%12zu bytes peak\n", stats.bytes_peak);
+	fprintf(stderr, "== size classes ==\n");
+	for (int i = 0; i <= POOL_CLASS_COUNT; i++) {
+		if (stats.allocations[i] == 0) continue;
+		if (i == LARGE_CLASS) {
+			fprintf(stderr, "%12s", "large");
+		} else {
+			fprintf(stderr, "%12d", (i + 1) * POOL_GRANULE);
+		}
+		fprintf(stderr, " %12llu allocated %12llu live\n",
+			(unsigned long long)stats.allocations[i], (unsigned long long)stats.live[i]);
+	}
+}
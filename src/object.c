@@ -1,5 +1,6 @@
 #include "object.h"
 
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -7,70 +8,212 @@
 #include "vm.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
 extern VM vm;
 
-#define ALLOCATE_OBJ(type, object_type) \
-	(type*)allocate_object(sizeof(type), object_type);
+static void object_link(Obj* object) {
+	object->next = vm.objects;
+	vm.objects = object;
+}
 
 
-static Obj* allocate_object(size_t size, ObjType type) {
-	Obj* object = (Obj*)reallocate(NULL, 0, size);
+static void object_init(Obj* object, ObjType type) {
 	object->type = type;
-	object->next = vm.objects;
-	vm.objects = object;
-	return object;
+	object->is_marked = vm.gc_state == GC_IDLE ? !vm.gc_mark : vm.gc_mark;
+	object->next = NULL;
 }
 
 
-static ObjString* allocate_string(char* chars, int length, uint32_t hash) {
-	ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+ObjString* string_allocate(int length) {
+	ObjString* string = (ObjString*)reallocate(NULL, 0, STRING_SIZE(length));
+	object_init(&string->obj, OBJ_STRING);
 	string->length = length;
-	string->chars = chars;
-	string->hash = hash;
-	table_insert(&vm.strings, string, VALUE_NIL);
+	string->chars[length] = '\0';
 	return string;
 }
 
-static uint32_t hash_string(const char* key, int length) {
-	uint32_t hash = 2166136261u;
-	for (int i = 0; i < length ; i++) {
-		hash ^= (uint8_t)key[i];
-		hash *= 16777619;
+
+ObjString* string_intern(ObjString* string) {
+	string->hash = hash_bytes(string->chars, string->length);
+	ObjString* interned = table_find_string(&vm.strings, string->chars, string->length, string->hash);
+	if (interned != NULL) {
+		reallocate(string, STRING_SIZE(string->length), 0);
+		GC_BARRIER(VALUE_OBJECT(interned));
+		return interned;
 	}
-	return hash;
+
+	object_link((Obj*)string);
+	vm_push(VALUE_OBJECT(string));
+	table_insert(&vm.strings, string, VALUE_NIL);
+	vm_pop();
+	return string;
 }
 
 
 ObjString* string_copy(const char *chars, int length) {
-	uint32_t hash = hash_string(chars, length);
+	uint32_t hash = hash_bytes(chars, length);
 	ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
-	if (interned != NULL)
+	if (interned != NULL) {
+		GC_BARRIER(VALUE_OBJECT(interned));
 		return interned;
+	}
 
-	char* heap_chars = ALLOCATE(char, length + 1);
-	memcpy(heap_chars, chars, length);
-	heap_chars[length] = '\0';
-	return allocate_string(heap_chars, length, hash);
+	ObjString* string = string_allocate(length);
+	memcpy(string->chars, chars, length);
+	string->hash = hash;
+	object_link((Obj*)string);
+	vm_push(VALUE_OBJECT(string));
+	table_insert(&vm.strings, string, VALUE_NIL);
+	vm_pop();
+	return string;
 }
 
-void object_print(Value value) {
-	switch (OBJ_TYPE(value)) {
-	case OBJ_STRING:
-		printf("%s", AS_CSTRING(value));
+
+static int text_length(Value value) {
+	return IS_STRING(value) ? AS_STRING(value)->length : AS_ROPE(value)->length;
+}
+
+
+// Replaces an already flattened rope with its string.
+static Value text_node(Value value) {
+	if (IS_ROPE(value) && AS_ROPE(value)->flat != NULL)
+		return VALUE_OBJECT(AS_ROPE(value)->flat);
+	return value;
+}
+
+
+typedef struct {
+	Value node;
+	int offset;
+} RopeTask;
+
+
+// Copies the characters of a rope into dest without recursing, since a rope
+// built by repeated `+` is as deep as the number of appends.
+static void rope_copy(ObjRope* rope, char* dest) {
+	int capacity = 16;
+	int count = 0;
+	RopeTask* tasks = malloc(sizeof(RopeTask) * capacity);
+	if (tasks == NULL) exit(1);
+	tasks[count++] = (RopeTask){ VALUE_OBJECT(rope), 0 };
+
+	while (count > 0) {
+		RopeTask task = tasks[--count];
+		Value node = text_node(task.node);
+		if (IS_STRING(node)) {
+			memcpy(dest + task.offset, AS_CSTRING(node), AS_STRING(node)->length);
+			continue;
+		}
+
+		ObjRope* inner = AS_ROPE(node);
+		if (count + 2 > capacity) {
+			capacity *= 2;
+			tasks = realloc(tasks, sizeof(RopeTask) * capacity);
+			if (tasks == NULL) exit(1);
+		}
+		tasks[count++] = (RopeTask){ inner->left, task.offset };
+		tasks[count++] = (RopeTask){ inner->right, task.offset + text_length(inner->left) };
 	}
+	free(tasks);
 }
 
 
-ObjString* take_string(char* chars, int length) {
-	uint32_t hash = hash_string(chars, length);
-	ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
-	if (interned != NULL) {
-		FREE_ARRAY(char, chars, length + 1);
-		return interned;
+#ifdef ROPES
+static ObjRope* rope_create(Value left, Value right, int length) {
+	ObjRope* rope = (ObjRope*)reallocate(NULL, 0, sizeof(ObjRope));
+	object_init(&rope->obj, OBJ_ROPE);
+	rope->length = length;
+	rope->left = left;
+	rope->right = right;
+	rope->flat = NULL;
+	object_link((Obj*)rope);
+	GC_BARRIER(left);
+	GC_BARRIER(right);
+	return rope;
+}
+
+
+// Leaves are private to their rope, so they are never hashed or interned.
+static ObjString* string_leaf(ObjString* a, ObjString* b) {
+	ObjString* leaf = string_allocate(a->length + b->length);
+	memcpy(leaf->chars, a->chars, a->length);
+	memcpy(leaf->chars + a->length, b->chars, b->length);
+	leaf->hash = 0;
+	object_link((Obj*)leaf);
+	return leaf;
+}
+#endif
+
+
+// Both operands must be reachable from the stack.
+Value string_concatenate(Value a, Value b) {
+	a = text_node(a);
+	b = text_node(b);
+	int length = text_length(a) + text_length(b);
+
+#ifdef ROPES
+	if (length >= ROPE_MIN_LENGTH) {
+		if (IS_ROPE(a) && IS_STRING(b) && IS_STRING(AS_ROPE(a)->right)) {
+			ObjRope* rope = AS_ROPE(a);
+			ObjString* right = AS_STRING(rope->right);
+			if (right->length + AS_STRING(b)->length <= ROPE_LEAF_MAX) {
+				ObjString* leaf = string_leaf(right, AS_STRING(b));
+				vm_push(VALUE_OBJECT(leaf));
+				ObjRope* result = rope_create(rope->left, VALUE_OBJECT(leaf), length);
+				vm_pop();
+				return VALUE_OBJECT(result);
+			}
+		}
+		return VALUE_OBJECT(rope_create(a, b, length));
+	}
+#endif
+
+	ObjString* result = string_allocate(length);
+	memcpy(result->chars, AS_CSTRING(a), AS_STRING(a)->length);
+	memcpy(result->chars + AS_STRING(a)->length, AS_CSTRING(b), AS_STRING(b)->length);
+	return VALUE_OBJECT(string_intern(result));
+}
+
+
+// The value must be reachable from the stack.
+ObjString* string_flatten(Value value) {
+	if (IS_STRING(value))
+		return AS_STRING(value);
+
+	ObjRope* rope = AS_ROPE(value);
+	if (rope->flat == NULL) {
+		ObjString* flat = string_allocate(rope->length);
+		rope_copy(rope, flat->chars);
+		flat = string_intern(flat);
+		rope->flat = flat;
+		rope->left = VALUE_NIL;
+		rope->right = VALUE_NIL;
+		GC_BARRIER(VALUE_OBJECT(flat));
 	}
+	return rope->flat;
+}
+
 
-	return allocate_string(chars, length, hash);
+void object_print(Value value) {
+	switch (OBJ_TYPE(value)) {
+	case OBJ_STRING:
+		printf("%s", AS_CSTRING(value));
+		break;
+	case OBJ_ROPE: {
+		ObjRope* rope = AS_ROPE(value);
+		if (rope->flat != NULL) {
+			printf("%s", rope->flat->chars);
+			break;
+		}
+		char* chars = malloc(rope->length);
+		if (chars == NULL) exit(1);
+		rope_copy(rope, chars);
+		fwrite(chars, 1, rope->length, stdout);
+		free(chars);
+		break;
+	}
+	}
 }
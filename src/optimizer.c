@@ -0,0 +1,300 @@
+#include "optimizer.h"
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+
+extern VM vm;
+
+
+typedef struct {
+	Chunk* chunk;
+	ConstantCache constants;
+	int* starts;
+	int count;
+	int capacity;
+} Optimizer;
+
+
+static void emit(Optimizer* optimizer, const uint8_t* code, int length, int line) {
+	if (optimizer->capacity < optimizer->count + 1) {
+		int old_capacity = optimizer->capacity;
+		optimizer->capacity = GROW_CAPACITY(old_capacity);
+		optimizer->starts = GROW_ARRAY(int, optimizer->starts, old_capacity, optimizer->capacity);
+	}
+	optimizer->starts[optimizer->count++] = optimizer->chunk->count;
+
+	for (int i = 0; i < length; i++)
+		chunk_write(optimizer->chunk, code[i], line);
+}
+
+
+static void drop(Optimizer* optimizer, int count) {
+	optimizer->count -= count;
+	chunk_truncate(optimizer->chunk, optimizer->starts[optimizer->count]);
+}
+
+
+static uint8_t* last(Optimizer* optimizer, int distance) {
+	if (optimizer->count <= distance) return NULL;
+	return &optimizer->chunk->code[optimizer->starts[optimizer->count - 1 - distance]];
+}
+
+
+static bool last_is(Optimizer* optimizer, int distance, OpCode op) {
+	uint8_t* instruction = last(optimizer, distance);
+	return instruction != NULL && *instruction == op;
+}
+
+
+static bool last_constant(Optimizer* optimizer, int distance, Value* value) {
+	uint8_t* instruction = last(optimizer, distance);
+	if (instruction == NULL) return false;
+
+	switch (*instruction) {
+	case OP_CONSTANT:
+	case OP_CONSTANT_LONG: {
+		int offset = (int)(instruction - optimizer->chunk->code);
+		*value = optimizer->chunk->constants.values[chunk_operand(optimizer->chunk, offset)];
+		return true;
+	}
+	case OP_NIL: *value = VALUE_NIL; return true;
+	case OP_TRUE: *value = VALUE_BOOL(true); return true;
+	case OP_FALSE: *value = VALUE_BOOL(false); return true;
+	default: return false;
+	}
+}
+
+
+static bool last_is_boolean(Optimizer* optimizer, int distance) {
+	uint8_t* instruction = last(optimizer, distance);
+	if (instruction == NULL) return false;
+
+	switch (*instruction) {
+	case OP_TRUE:
+	case OP_FALSE:
+	case OP_NOT:
+	case OP_EQUAL:
+	case OP_NOT_EQUAL:
+	case OP_GREATER:
+	case OP_LESS:
+	case OP_EQUAL_CONSTANT:
+	case OP_GREATER_CONSTANT:
+	case OP_LESS_CONSTANT:
+	case OP_NOT_EQUAL_CONSTANT:
+	case OP_NOT_GREATER_CONSTANT:
+	case OP_NOT_LESS_CONSTANT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+static OpCode fused_constant_op(OpCode op) {
+	switch (op) {
+	case OP_ADD: return OP_ADD_CONSTANT;
+	case OP_EQUAL: return OP_EQUAL_CONSTANT;
+	case OP_GREATER: return OP_GREATER_CONSTANT;
+	case OP_LESS: return OP_LESS_CONSTANT;
+	default: return op;
+	}
+}
+
+
+static OpCode unfused_constant_op(OpCode op) {
+	switch (op) {
+	case OP_ADD_CONSTANT: return OP_ADD;
+	case OP_EQUAL_CONSTANT: return OP_EQUAL;
+	case OP_GREATER_CONSTANT: return OP_GREATER;
+	case OP_LESS_CONSTANT: return OP_LESS;
+	default: return op;
+	}
+}
+
+
+// The comparison that leaves the opposite boolean, or op itself if there is
+// none.
+static OpCode negated_op(OpCode op) {
+	switch (op) {
+	case OP_EQUAL: return OP_NOT_EQUAL;
+	case OP_NOT_EQUAL: return OP_EQUAL;
+	case OP_EQUAL_CONSTANT: return OP_NOT_EQUAL_CONSTANT;
+	case OP_NOT_EQUAL_CONSTANT: return OP_EQUAL_CONSTANT;
+	case OP_GREATER_CONSTANT: return OP_NOT_GREATER_CONSTANT;
+	case OP_NOT_GREATER_CONSTANT: return OP_GREATER_CONSTANT;
+	case OP_LESS_CONSTANT: return OP_NOT_LESS_CONSTANT;
+	case OP_NOT_LESS_CONSTANT: return OP_LESS_CONSTANT;
+	default: return op;
+	}
+}
+
+
+static bool is_falsy(Value value) {
+	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+
+static bool replace_constants(Optimizer* optimizer, int count, Value value, int line) {
+	uint8_t code[4];
+	int length = 1;
+	if (IS_NIL(value)) {
+		code[0] = OP_NIL;
+	} else if (IS_BOOL(value)) {
+		code[0] = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+	} else {
+		int constant = chunk_add_constant(optimizer->chunk, &optimizer->constants, value);
+		if (constant > OPERAND_LONG_MAX)
+			return false;
+		code[0] = constant > UINT8_MAX ? OP_CONSTANT_LONG : OP_CONSTANT;
+		code[1] = (uint8_t)constant;
+		code[2] = (uint8_t)(constant >> 8);
+		code[3] = (uint8_t)(constant >> 16);
+		length = constant > UINT8_MAX ? 4 : 2;
+	}
+
+	drop(optimizer, count);
+	emit(optimizer, code, length, line);
+	return true;
+}
+
+
+static Value concatenate(ObjString* a, ObjString* b) {
+	ObjString* result = string_allocate(a->length + b->length);
+	memcpy(result->chars, a->chars, a->length);
+	memcpy(result->chars + a->length, b->chars, b->length);
+	return VALUE_OBJECT(string_intern(result));
+}
+
+
+static bool fold_binary(OpCode op, Value a, Value b, Value* result) {
+	if (op == OP_EQUAL) {
+		*result = VALUE_BOOL(value_equal(a, b));
+		return true;
+	}
+	if (op == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+		*result = concatenate(AS_STRING(a), AS_STRING(b));
+		return true;
+	}
+	if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+	double left = AS_NUMBER(a);
+	double right = AS_NUMBER(b);
+	switch (op) {
+	case OP_ADD: *result = VALUE_NUMBER(left + right); return true;
+	case OP_SUBTRACT: *result = VALUE_NUMBER(left - right); return true;
+	case OP_MULTIPLY: *result = VALUE_NUMBER(left * right); return true;
+	case OP_DIVIDE: *result = VALUE_NUMBER(left / right); return true;
+	case OP_GREATER: *result = VALUE_BOOL(left > right); return true;
+	case OP_LESS: *result = VALUE_BOOL(left < right); return true;
+	default: return false;
+	}
+}
+
+
+static void optimize_not(Optimizer* optimizer, const uint8_t* code, int line) {
+	Value value;
+	uint8_t* previous = last(optimizer, 0);
+	if (last_constant(optimizer, 0, &value)) {
+		replace_constants(optimizer, 1, VALUE_BOOL(is_falsy(value)), line);
+	} else if (previous != NULL && negated_op(*previous) != *previous) {
+		*previous = negated_op(*previous);
+	} else if (last_is(optimizer, 0, OP_NOT) && last_is_boolean(optimizer, 1)) {
+		drop(optimizer, 1);
+	} else {
+		emit(optimizer, code, 1, line);
+	}
+}
+
+
+static void optimize_instruction(Optimizer* optimizer, const uint8_t* code, int length, int line) {
+	Value a;
+	Value b;
+	Value result;
+
+	switch (code[0]) {
+	case OP_NEGATE:
+		if (last_constant(optimizer, 0, &a) && IS_NUMBER(a) &&
+			replace_constants(optimizer, 1, VALUE_NUMBER(-AS_NUMBER(a)), line))
+			return;
+		break;
+	case OP_NOT:
+		optimize_not(optimizer, code, line);
+		return;
+	case OP_ADD:
+	case OP_SUBTRACT:
+	case OP_MULTIPLY:
+	case OP_DIVIDE:
+	case OP_EQUAL:
+	case OP_GREATER:
+	case OP_LESS:
+		if (last_constant(optimizer, 1, &a) && last_constant(optimizer, 0, &b) &&
+			fold_binary(code[0], a, b, &result) &&
+			replace_constants(optimizer, 2, result, line))
+			return;
+		if (fused_constant_op(code[0]) != code[0] && last_is(optimizer, 0, OP_CONSTANT)) {
+			*last(optimizer, 0) = fused_constant_op(code[0]);
+			return;
+		}
+		break;
+	case OP_ADD_CONSTANT:
+	case OP_EQUAL_CONSTANT:
+	case OP_GREATER_CONSTANT:
+	case OP_LESS_CONSTANT:
+		b = optimizer->chunk->constants.values[code[1]];
+		if (last_constant(optimizer, 0, &a) &&
+			fold_binary(unfused_constant_op(code[0]), a, b, &result) &&
+			replace_constants(optimizer, 1, result, line))
+			return;
+		break;
+	case OP_POP:
+		if (last_constant(optimizer, 0, &a)) {
+			drop(optimizer, 1);
+			return;
+		}
+		if (last_is(optimizer, 0, OP_SET_GLOBAL)) {
+			*last(optimizer, 0) = OP_SET_GLOBAL_POP;
+			return;
+		}
+		if (last_is(optimizer, 0, OP_SET_GLOBAL_LONG)) {
+			*last(optimizer, 0) = OP_SET_GLOBAL_POP_LONG;
+			return;
+		}
+		break;
+	}
+
+	emit(optimizer, code, length, line);
+}
+
+
+void chunk_optimize(Chunk* chunk) {
+	Chunk out = chunk_create();
+	for (int i = 0; i < chunk->constants.count; i++)
+		chunk_write_constant(&out, chunk->constants.values[i]);
+	vm.chunk = &out;
+
+	Optimizer optimizer;
+	optimizer.chunk = &out;
+	optimizer.constants = constant_cache_create();
+	optimizer.starts = NULL;
+	optimizer.count = 0;
+	optimizer.capacity = 0;
+
+	for (int offset = 0; offset < chunk->count;) {
+		int length = chunk_instruction_length(chunk, offset);
+		optimize_instruction(&optimizer, &chunk->code[offset], length, chunk_get_line(chunk, offset));
+		offset += length;
+	}
+
+	FREE_ARRAY(int, optimizer.starts, optimizer.capacity);
+	constant_cache_free(&optimizer.constants);
+	chunk_free(chunk);
+	*chunk = out;
+	vm.chunk = chunk;
+}
@@ -0,0 +1,94 @@
+#include "options.h"
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+Options options;
+
+
+int options_parse(int argc, char* argv[]) {
+	options.optimize = false;
+	options.trace = false;
+	options.dump_bytecode = false;
+	options.compile = false;
+	options.profile = false;
+	options.profile_pairs = false;
+	options.profile_folded = NULL;
+	options.mem_stats = false;
+	options.gc_stress = false;
+	options.gc_log = false;
+	options.gc_growth = 2.0;
+	options.gc_incremental = false;
+	options.gc_step = 1024;
+	options.quicken_stats = false;
+
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "-O") == 0) {
+			options.optimize = true;
+		} else if (strcmp(argv[arg], "--trace") == 0) {
+#ifdef DEBUG_TRACE_EXECUTION
+			options.trace = true;
+#else
+			fprintf(stderr, "Tracing is compiled out of release builds.\n");
+			return -1;
+#endif
+		} else if (strcmp(argv[arg], "--dump-bytecode") == 0) {
+			options.dump_bytecode = true;
+		} else if (strcmp(argv[arg], "--compile") == 0) {
+			options.compile = true;
+		} else if (strcmp(argv[arg], "--profile") == 0) {
+			options.profile = true;
+		} else if (strncmp(argv[arg], "--profile=", 10) == 0) {
+			options.profile = true;
+			options.profile_folded = argv[arg] + 10;
+		} else if (strcmp(argv[arg], "--profile-pairs") == 0) {
+			options.profile_pairs = true;
+		} else if (strcmp(argv[arg], "--mem-stats") == 0) {
+			options.mem_stats = true;
+		} else if (strcmp(argv[arg], "--gc-stress") == 0) {
+			options.gc_stress = true;
+		} else if (strcmp(argv[arg], "--gc-log") == 0) {
+			options.gc_log = true;
+		} else if (strncmp(argv[arg], "--gc-growth=", 12) == 0) {
+			char* end;
+			options.gc_growth = strtod(argv[arg] + 12, &end);
+			if (*end != '\0' || !(options.gc_growth > 1.0)) {
+				fprintf(stderr, "GC growth factor must be a number above 1.\n");
+				return -1;
+			}
+		} else if (strcmp(argv[arg], "--gc-incremental") == 0) {
+			options.gc_incremental = true;
+		} else if (strncmp(argv[arg], "--gc-step=", 10) == 0) {
+			char* end;
+			long long step = strtoll(argv[arg] + 10, &end, 10);
+			if (*end != '\0' || step < 1) {
+				fprintf(stderr, "GC step budget must be a positive integer.\n");
+				return -1;
+			}
+			options.gc_incremental = true;
+			options.gc_step = (size_t)step;
+		} else if (strcmp(argv[arg], "--quicken-stats") == 0) {
+#ifdef QUICKENING
+			options.quicken_stats = true;
+#else
+			fprintf(stderr, "Quickening is compiled out of this build.\n");
+			return -1;
+#endif
+		} else {
+			fprintf(stderr, "Unknown option '%s'.\n", argv[arg]);
+			return -1;
+		}
+	}
+#ifndef PROFILE_EXECUTION
+	if (options.profile || options.profile_pairs) {
+		fprintf(stderr, "Profiling is compiled out of this build.\n");
+		return -1;
+	}
+#endif
+	return arg;
+}
@@ -0,0 +1,353 @@
+#include "profile.h"
+#include "chunk.h"
+#include "debug.h"
+#include "memory.h"
+#include "options.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+#else
+#define CYCLE_UNIT "ns"
+#endif
+
+
+#define PROFILE_TOP 20
+
+
+typedef struct {
+	uint64_t count;
+	uint64_t cycles;
+	int line;
+	uint8_t ops[3];
+} Sample;
+
+
+extern Options options;
+
+static uint64_t op_counts[OPCODE_COUNT];
+static uint64_t op_cycles[OPCODE_COUNT];
+
+// Per-line figures live in an open-addressed map keyed by line and opcode,
+// so memory follows what actually ran rather than the highest line number.
+// A key of zero marks an empty slot.
+typedef struct {
+	uint32_t key;
+	uint64_t count;
+	uint64_t cycles;
+} LineEntry;
+
+static bool profile_lines = true;
+static LineEntry* line_entries = NULL;
+static int line_count = 0;
+static int line_capacity = 0;
+
+static uint64_t* pairs = NULL;
+static uint64_t* triples = NULL;
+static int previous[2];
+
+static uint64_t last_stamp;
+static int last_op = -1;
+static int last_line;
+
+
+static uint64_t cycles_now() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+
+static LineEntry* line_slot(LineEntry* entries, int capacity, uint32_t key) {
+	uint32_t mask = (uint32_t)capacity - 1;
+	for (uint32_t i = (key * 2654435761u) & mask;; i = (i + 1) & mask) {
+		if (entries[i].key == key || entries[i].key == 0)
+			return &entries[i];
+	}
+}
+
+
+// Profiler storage stays outside reallocate() so it doesn't count towards
+// the GC heap.
+static LineEntry* line_entry(int line, int op) {
+	if (line_count + 1 > line_capacity * 3 / 4) {
+		int capacity = GROW_CAPACITY(line_capacity);
+		LineEntry* entries = calloc(capacity, sizeof(LineEntry));
+		if (entries == NULL)
+			exit(1);
+		for (int i = 0; i < line_capacity; i++) {
+			if (line_entries[i].key != 0)
+				*line_slot(entries, capacity, line_entries[i].key) = line_entries[i];
+		}
+		free(line_entries);
+		line_entries = entries;
+		line_capacity = capacity;
+	}
+
+	uint32_t key = (uint32_t)line * OPCODE_COUNT + op + 1;
+	LineEntry* entry = line_slot(line_entries, line_capacity, key);
+	if (entry->key == 0) {
+		entry->key = key;
+		line_count++;
+	}
+	return entry;
+}
+
+
+// Every REPL line is line 1 of its own chunk, so only opcode totals are
+// kept there.
+void profile_skip_lines() {
+	profile_lines = false;
+}
+
+
+static void pending_charge(uint64_t now) {
+	if (last_op < 0) return;
+
+	op_cycles[last_op] += now - last_stamp;
+	if (profile_lines)
+		line_entry(last_line, last_op)->cycles += now - last_stamp;
+	last_op = -1;
+}
+
+
+// Charges the chunk's last instruction, usually OP_RETURN, which no later
+// dispatch would otherwise close.
+void profile_chunk_end() {
+	if (options.profile)
+		pending_charge(cycles_now());
+}
+
+
+static void sequences_count(int op, int offset) {
+	if (pairs == NULL) {
+		pairs = calloc(OPCODE_COUNT * OPCODE_COUNT, sizeof(uint64_t));
+		triples = calloc(OPCODE_COUNT * OPCODE_COUNT * OPCODE_COUNT, sizeof(uint64_t));
+		if (pairs == NULL || triples == NULL)
+			exit(1);
+	}
+
+	if (offset == 0)
+		previous[0] = previous[1] = -1;
+
+	if (previous[1] >= 0)
+		pairs[previous[1] * OPCODE_COUNT + op]++;
+	if (previous[0] >= 0)
+		triples[(previous[0] * OPCODE_COUNT + previous[1]) * OPCODE_COUNT + op]++;
+
+	previous[0] = previous[1];
+	previous[1] = op;
+}
+
+
+void profile_instruction(Chunk* chunk, int offset) {
+	int op = chunk->code[offset];
+
+	if (options.profile_pairs)
+		sequences_count(op, offset);
+	if (!options.profile)
+		return;
+
+	pending_charge(cycles_now());
+
+	op_counts[op]++;
+	if (profile_lines) {
+		last_line = chunk_get_line(chunk, offset);
+		line_entry(last_line, op)->count++;
+	}
+
+	last_op = op;
+	last_stamp = cycles_now();
+}
+
+
+static int sample_compare(const void* a, const void* b) {
+	const Sample* left = (const Sample*)a;
+	const Sample* right = (const Sample*)b;
+	if (left->cycles != right->cycles)
+		return (left->cycles < right->cycles) - (left->cycles > right->cycles);
+	return (left->count < right->count) - (left->count > right->count);
+}
+
+
+static void sequences_report(const char* title, uint64_t* counts, int length) {
+	int total = 1;
+	for (int i = 0; i < length; i++)
+		total *= OPCODE_COUNT;
+
+	int count = 0;
+	Sample* samples = malloc(sizeof(Sample) * total);
+	if (samples == NULL)
+		exit(1);
+	for (int i = 0; i < total; i++) {
+		if (counts[i] == 0) continue;
+
+		Sample* sample = &samples[count++];
+		sample->count = counts[i];
+		sample->cycles = 0;
+		for (int op = i, slot = length - 1; slot >= 0; slot--, op /= OPCODE_COUNT)
+			sample->ops[slot] = op % OPCODE_COUNT;
+	}
+
+	qsort(samples, count, sizeof(Sample), sample_compare);
+
+	fprintf(stderr, "== %s ==\n", title);
+	for (int i = 0; i < count && i < PROFILE_TOP; i++) {
+		fprintf(stderr, "%12llu ", (unsigned long long)samples[i].count);
+		for (int slot = 0; slot < length; slot++)
+			fprintf(stderr, " %s", opcode_name(samples[i].ops[slot]));
+		fprintf(stderr, "\n");
+	}
+
+	free(samples);
+}
+
+
+static void opcodes_report() {
+	uint64_t total = 0;
+	Sample samples[OPCODE_COUNT];
+	int count = 0;
+	for (int op = 0; op < OPCODE_COUNT; op++) {
+		total += op_cycles[op];
+		if (op_counts[op] == 0) continue;
+
+		samples[count].count = op_counts[op];
+		samples[count].cycles = op_cycles[op];
+		samples[count].ops[0] = op;
+		count++;
+	}
+
+	qsort(samples, count, sizeof(Sample), sample_compare);
+
+	fprintf(stderr, "== opcodes ==\n");
+	fprintf(stderr, "%-20s %12s %14s %7s %9s\n", "opcode", "count", CYCLE_UNIT, "%", "avg");
+	for (int i = 0; i < count; i++) {
+		Sample* sample = &samples[i];
+		fprintf(stderr, "%-20s %12llu %14llu %6.2f%% %9.1f\n",
+			opcode_name(sample->ops[0]),
+			(unsigned long long)sample->count,
+			(unsigned long long)sample->cycles,
+			total == 0 ? 0.0 : 100.0 * sample->cycles / total,
+			(double)sample->cycles / sample->count);
+	}
+}
+
+
+static int sample_compare_line(const void* a, const void* b) {
+	const Sample* left = (const Sample*)a;
+	const Sample* right = (const Sample*)b;
+	if (left->line != right->line)
+		return (left->line > right->line) - (left->line < right->line);
+	return (left->ops[0] > right->ops[0]) - (left->ops[0] < right->ops[0]);
+}
+
+
+// The (line, opcode) entries as samples, ordered by line and then opcode.
+static Sample* line_samples() {
+	Sample* samples = malloc(sizeof(Sample) * (line_count + 1));
+	if (samples == NULL)
+		exit(1);
+
+	int count = 0;
+	for (int i = 0; i < line_capacity; i++) {
+		LineEntry* entry = &line_entries[i];
+		if (entry->key == 0) continue;
+
+		Sample* sample = &samples[count++];
+		sample->count = entry->count;
+		sample->cycles = entry->cycles;
+		sample->line = (int)((entry->key - 1) / OPCODE_COUNT);
+		sample->ops[0] = (entry->key - 1) % OPCODE_COUNT;
+	}
+	qsort(samples, count, sizeof(Sample), sample_compare_line);
+	return samples;
+}
+
+
+static void lines_report() {
+	Sample* samples = line_samples();
+	int count = 0;
+	for (int i = 0; i < line_count; i++) {
+		if (count > 0 && samples[count - 1].line == samples[i].line) {
+			samples[count - 1].count += samples[i].count;
+			samples[count - 1].cycles += samples[i].cycles;
+		} else {
+			samples[count++] = samples[i];
+		}
+	}
+
+	qsort(samples, count, sizeof(Sample), sample_compare);
+
+	fprintf(stderr, "== lines ==\n");
+	fprintf(stderr, "%-8s %12s %14s\n", "line", "instructions", CYCLE_UNIT);
+	for (int i = 0; i < count && i < PROFILE_TOP; i++) {
+		fprintf(stderr, "%-8d %12llu %14llu\n",
+			samples[i].line,
+			(unsigned long long)samples[i].count,
+			(unsigned long long)samples[i].cycles);
+	}
+
+	free(samples);
+}
+
+
+static void folded_write(const char* path) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open profile output \"%s\".\n", path);
+		return;
+	}
+
+	if (profile_lines) {
+		Sample* samples = line_samples();
+		for (int i = 0; i < line_count; i++) {
+			if (samples[i].cycles == 0) continue;
+			fprintf(file, "script;line %d;%s %llu\n", samples[i].line,
+				opcode_name(samples[i].ops[0]), (unsigned long long)samples[i].cycles);
+		}
+		free(samples);
+	} else {
+		for (int op = 0; op < OPCODE_COUNT; op++) {
+			if (op_cycles[op] == 0) continue;
+			fprintf(file, "script;%s %llu\n", opcode_name(op), (unsigned long long)op_cycles[op]);
+		}
+	}
+
+	fclose(file);
+}
+
+
+void profile_report() {
+	if (options.profile) {
+		opcodes_report();
+		if (profile_lines)
+			lines_report();
+		if (options.profile_folded != NULL)
+			folded_write(options.profile_folded);
+
+		free(line_entries);
+		line_entries = NULL;
+		line_count = 0;
+		line_capacity = 0;
+	}
+
+	if (pairs != NULL) {
+		sequences_report("opcode pairs", pairs, 2);
+		sequences_report("opcode triples", triples, 3);
+
+		free(pairs);
+		free(triples);
+		pairs = NULL;
+		triples = NULL;
+	}
+}
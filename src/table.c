@@ -1,3 +1,7 @@
+#include "common.h"
+
+#if !defined(TABLE_SWISS) && !defined(TABLE_COMPACT)
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -7,14 +11,22 @@
 #include "object.h"
 #include "table.h"
 #include "value.h"
+#include "vm.h"
 
 #define TABLE_MAX_LOAD 0.75
+#define TABLE_MIN_LOAD 0.25
+// Capacities are always powers of two, so probing can mask instead of divide.
+#define TABLE_MIN_CAPACITY 8
+
+extern VM vm;
 
 Table table_create() {
 	Table table;
 	table.count = 0;
+	table.tombstones = 0;
 	table.capacity = 0;
 	table.entries = NULL;
+	table.version = 1;
 	return table;
 }
 
@@ -22,13 +34,16 @@ Table table_create() {
 void table_free(Table *table) {
 	FREE_ARRAY(Entry, table->entries, table->capacity);
 	table->count = 0;
+	table->tombstones = 0;
 	table->capacity = 0;
 	table->entries = NULL;
+	table->version++;
 }
 
 
 static Entry* entry_find(Entry* entries, int capacity, ObjString* key) {
-	uint32_t index = key->hash % capacity;
+	uint32_t mask = (uint32_t)capacity - 1;
+	uint32_t index = key->hash & mask;
 	Entry* tombstone = NULL;
 
 	for (;;) {
@@ -44,7 +59,7 @@ static Entry* entry_find(Entry* entries, int capacity, ObjString* key) {
 		} else if (entry->key == key) {
 			return entry;
 		} 
-		index = (index + 1) % capacity;
+		index = (index + 1) & mask;
 	}
 }
 
@@ -56,6 +71,7 @@ static void adjust_capacity(Table* table, int capacity) {
 	}
 
 	table->count = 0;
+	table->tombstones = 0;
 	for (int i = 0; i < table->capacity; i++) {
 		Entry* entry = &table->entries[i];
 		if (entry->key == NULL) continue;
@@ -63,13 +79,14 @@ static void adjust_capacity(Table* table, int capacity) {
 		Entry* dest = entry_find(entries, capacity, entry->key);
 		dest->key = entry->key;
 		dest->value = entry->value;
-		table->count = 0;
+		table->count++;
 	}
 
 	FREE_ARRAY(Entry, table->entries, table->capacity);
 
 	table->entries = entries;
 	table->capacity = capacity;
+	table->version++;
 }
 
 
@@ -83,6 +100,8 @@ bool table_insert(Table* table, ObjString* key, Value value) {
 	bool is_new_key = entry->key == NULL;
 	if (is_new_key && IS_NIL(entry->value))
 		table->count++;
+	else if (is_new_key)
+		table->tombstones--;
 
 	entry->key = key;
 	entry->value = value;
@@ -110,6 +129,16 @@ bool table_get(Table *table, ObjString *key, Value *value) {
 }
 
 
+Entry* table_find_entry(Table* table, ObjString* key) {
+	if (table->count == 0) return NULL;
+
+	Entry* entry = entry_find(table->entries, table->capacity, key);
+	if (entry->key == NULL) return NULL;
+
+	return entry;
+}
+
+
 bool table_delete(Table *table, ObjString *key) {
 	if (table->count == 0) return false;
 
@@ -118,15 +147,60 @@ bool table_delete(Table *table, ObjString *key) {
 
 	entry->key = NULL;
 	entry->value = VALUE_BOOL(true);
+	table->tombstones++;
+	table->version++;
 	return true;
 
 }
 
 
+// Shrinks a table whose load has fallen below TABLE_MIN_LOAD, or rehashes it
+// in place once tombstones take up a quarter of it.
+bool table_compact(Table* table) {
+	if (table->capacity == 0)
+		return false;
+
+	int live = table->count - table->tombstones;
+	int capacity = table->capacity;
+	while (capacity > TABLE_MIN_CAPACITY && live < capacity * TABLE_MIN_LOAD)
+		capacity /= 2;
+
+	if (capacity == table->capacity && table->tombstones < table->capacity * TABLE_MIN_LOAD)
+		return false;
+	adjust_capacity(table, capacity);
+	return true;
+}
+
+
+TableStats table_stats(Table* table) {
+	TableStats stats;
+	stats.capacity = table->capacity;
+	stats.live = table->count - table->tombstones;
+	stats.tombstones = table->tombstones;
+	stats.max_probe = 0;
+
+	int mask = table->capacity - 1;
+	long probes = 0;
+	for (int i = 0; i < table->capacity; i++) {
+		Entry* entry = &table->entries[i];
+		if (entry->key == NULL) continue;
+
+		int home = (int)(entry->key->hash & (uint32_t)mask);
+		int probe = ((i - home) & mask) + 1;
+		probes += probe;
+		if (probe > stats.max_probe)
+			stats.max_probe = probe;
+	}
+	stats.average_probe = stats.live > 0 ? (double)probes / stats.live : 0.0;
+	return stats;
+}
+
+
 ObjString* table_find_string(Table *table, const char *chars, int length, uint32_t hash) {
 	if (table->count == 0) return NULL;
 
-	uint32_t index = hash % table->capacity;
+	uint32_t mask = (uint32_t)table->capacity - 1;
+	uint32_t index = hash & mask;
 	for (;;) {
 		Entry* entry = &table->entries[index];
 		if (entry->key == NULL) {
@@ -138,8 +212,36 @@ ObjString* table_find_string(Table *table, const char *chars, int length, uint32
 		) {
 			return entry->key;
 		}
-		index = (index + 1) % table->capacity;
+		index = (index + 1) & mask;
 	}
 
 }
 
+
+static int table_range_end(Table* table, int from, size_t budget) {
+	return budget < (size_t)(table->capacity - from) ? from + (int)budget : table->capacity;
+}
+
+
+int table_mark(Table* table, int from, size_t budget) {
+	int to = table_range_end(table, from, budget);
+	for (int i = from; i < to; i++) {
+		Entry* entry = &table->entries[i];
+		gc_mark_object((Obj*)entry->key);
+		gc_mark_value(entry->value);
+	}
+	return to;
+}
+
+
+int table_remove_white(Table* table, int from, size_t budget) {
+	int to = table_range_end(table, from, budget);
+	for (int i = from; i < to; i++) {
+		Entry* entry = &table->entries[i];
+		if (entry->key != NULL && !IS_MARKED((Obj*)entry->key))
+			table_delete(table, entry->key);
+	}
+	return to;
+}
+
+#endif
@@ -0,0 +1,280 @@
+#include "common.h"
+
+#ifdef TABLE_COMPACT
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+// Entries are appended to a dense array in insertion order. The sparse
+// index holds positions into it, one, two or four bytes wide depending on
+// capacity. `count` is the number of dense entries used, deleted ones
+// included; a deleted entry has a NULL key and a DELETED index slot.
+#define TABLE_MAX_LOAD 0.75
+#define TABLE_MIN_LOAD 0.25
+#define TABLE_MIN_CAPACITY 8
+
+#define INDEX_EMPTY -1
+#define INDEX_DELETED -2
+
+#define DENSE_CAPACITY(capacity) ((int)((capacity) * TABLE_MAX_LOAD))
+
+extern VM vm;
+
+
+static size_t index_width(int capacity) {
+	if (capacity <= 128) return sizeof(int8_t);
+	if (capacity <= 32768) return sizeof(int16_t);
+	return sizeof(int32_t);
+}
+
+
+static int32_t index_get(void* index, int capacity, int slot) {
+	switch (index_width(capacity)) {
+	case sizeof(int8_t): return ((int8_t*)index)[slot];
+	case sizeof(int16_t): return ((int16_t*)index)[slot];
+	default: return ((int32_t*)index)[slot];
+	}
+}
+
+
+static void index_set(void* index, int capacity, int slot, int32_t position) {
+	switch (index_width(capacity)) {
+	case sizeof(int8_t): ((int8_t*)index)[slot] = (int8_t)position; break;
+	case sizeof(int16_t): ((int16_t*)index)[slot] = (int16_t)position; break;
+	default: ((int32_t*)index)[slot] = position; break;
+	}
+}
+
+
+Table table_create() {
+	Table table;
+	table.count = 0;
+	table.tombstones = 0;
+	table.capacity = 0;
+	table.entries = NULL;
+	table.index = NULL;
+	table.version = 1;
+	return table;
+}
+
+
+static void table_release(Entry* entries, void* index, int capacity) {
+	FREE_ARRAY(Entry, entries, DENSE_CAPACITY(capacity));
+	reallocate(index, index_width(capacity) * capacity, 0);
+}
+
+
+void table_free(Table *table) {
+	if (table->capacity > 0)
+		table_release(table->entries, table->index, table->capacity);
+	table->count = 0;
+	table->tombstones = 0;
+	table->capacity = 0;
+	table->entries = NULL;
+	table->index = NULL;
+	table->version++;
+}
+
+
+// Returns the index slot holding key, or the empty slot that ends its probe
+// sequence.
+static int slot_find(Table* table, ObjString* key) {
+	uint32_t mask = (uint32_t)table->capacity - 1;
+	for (uint32_t slot = key->hash & mask;; slot = (slot + 1) & mask) {
+		int32_t position = index_get(table->index, table->capacity, slot);
+		if (position == INDEX_EMPTY || (position >= 0 && table->entries[position].key == key))
+			return (int)slot;
+	}
+}
+
+
+static Entry* entry_find(Table* table, ObjString* key) {
+	if (table->count == 0) return NULL;
+
+	int32_t position = index_get(table->index, table->capacity, slot_find(table, key));
+	return position < 0 ? NULL : &table->entries[position];
+}
+
+
+static void adjust_capacity(Table* table, int capacity) {
+	Entry* entries = ALLOCATE(Entry, DENSE_CAPACITY(capacity));
+	void* index = reallocate(NULL, 0, index_width(capacity) * capacity);
+	memset(index, 0xff, index_width(capacity) * capacity);
+
+	uint32_t mask = (uint32_t)capacity - 1;
+	int count = 0;
+	for (int i = 0; i < table->count; i++) {
+		Entry* entry = &table->entries[i];
+		if (entry->key == NULL) continue;
+
+		uint32_t slot = entry->key->hash & mask;
+		while (index_get(index, capacity, slot) != INDEX_EMPTY)
+			slot = (slot + 1) & mask;
+		index_set(index, capacity, slot, count);
+		entries[count++] = *entry;
+	}
+
+	if (table->capacity > 0)
+		table_release(table->entries, table->index, table->capacity);
+
+	table->entries = entries;
+	table->index = index;
+	table->capacity = capacity;
+	table->count = count;
+	table->tombstones = 0;
+	table->version++;
+}
+
+
+bool table_insert(Table* table, ObjString* key, Value value) {
+	Entry* entry = entry_find(table, key);
+	if (entry != NULL) {
+		entry->value = value;
+		return false;
+	}
+
+	if (table->count + 1 > DENSE_CAPACITY(table->capacity))
+		adjust_capacity(table, GROW_CAPACITY(table->capacity));
+
+	index_set(table->index, table->capacity, slot_find(table, key), table->count);
+	entry = &table->entries[table->count++];
+	entry->key = key;
+	entry->value = value;
+	return true;
+}
+
+
+void table_add_all(Table *from, Table *to) {
+	for (int i = 0; i < from->count; i++) {
+		Entry* entry = &from->entries[i];
+		if (entry->key != NULL)
+			table_insert(to, entry->key, entry->value);
+	}
+}
+
+
+bool table_get(Table *table, ObjString *key, Value *value) {
+	Entry* entry = entry_find(table, key);
+	if (entry == NULL) return false;
+
+	*value = entry->value;
+	return true;
+}
+
+
+Entry* table_find_entry(Table* table, ObjString* key) {
+	return entry_find(table, key);
+}
+
+
+bool table_delete(Table *table, ObjString *key) {
+	if (table->count == 0) return false;
+
+	int slot = slot_find(table, key);
+	int32_t position = index_get(table->index, table->capacity, slot);
+	if (position < 0) return false;
+
+	index_set(table->index, table->capacity, slot, INDEX_DELETED);
+	table->entries[position].key = NULL;
+	table->entries[position].value = VALUE_NIL;
+	table->tombstones++;
+	table->version++;
+	return true;
+}
+
+
+// Shrinks a table whose load has fallen below TABLE_MIN_LOAD, or rehashes it
+// in place once tombstones take up a quarter of it.
+bool table_compact(Table* table) {
+	if (table->capacity == 0)
+		return false;
+
+	int live = table->count - table->tombstones;
+	int capacity = table->capacity;
+	while (capacity > TABLE_MIN_CAPACITY && live < capacity * TABLE_MIN_LOAD)
+		capacity /= 2;
+
+	if (capacity == table->capacity && table->tombstones < table->capacity * TABLE_MIN_LOAD)
+		return false;
+	adjust_capacity(table, capacity);
+	return true;
+}
+
+
+TableStats table_stats(Table* table) {
+	TableStats stats;
+	stats.capacity = table->capacity;
+	stats.live = table->count - table->tombstones;
+	stats.tombstones = table->tombstones;
+	stats.max_probe = 0;
+
+	int mask = table->capacity - 1;
+	long probes = 0;
+	for (int i = 0; i < table->capacity; i++) {
+		int32_t position = index_get(table->index, table->capacity, i);
+		if (position < 0) continue;
+
+		int home = (int)(table->entries[position].key->hash & (uint32_t)mask);
+		int probe = ((i - home) & mask) + 1;
+		probes += probe;
+		if (probe > stats.max_probe)
+			stats.max_probe = probe;
+	}
+	stats.average_probe = stats.live > 0 ? (double)probes / stats.live : 0.0;
+	return stats;
+}
+
+
+ObjString* table_find_string(Table *table, const char *chars, int length, uint32_t hash) {
+	if (table->count == 0) return NULL;
+
+	uint32_t mask = (uint32_t)table->capacity - 1;
+	for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+		int32_t position = index_get(table->index, table->capacity, slot);
+		if (position == INDEX_EMPTY) return NULL;
+		if (position == INDEX_DELETED) continue;
+
+		ObjString* key = table->entries[position].key;
+		if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0)
+			return key;
+	}
+}
+
+
+// The GC walks the dense array; positions from count up to capacity are
+// empty.
+static int table_range_end(Table* table, int from, size_t budget) {
+	return budget < (size_t)(table->capacity - from) ? from + (int)budget : table->capacity;
+}
+
+
+int table_mark(Table* table, int from, size_t budget) {
+	int to = table_range_end(table, from, budget);
+	for (int i = from; i < to && i < table->count; i++) {
+		Entry* entry = &table->entries[i];
+		gc_mark_object((Obj*)entry->key);
+		gc_mark_value(entry->value);
+	}
+	return to;
+}
+
+
+int table_remove_white(Table* table, int from, size_t budget) {
+	int to = table_range_end(table, from, budget);
+	for (int i = from; i < to && i < table->count; i++) {
+		Entry* entry = &table->entries[i];
+		if (entry->key != NULL && !IS_MARKED((Obj*)entry->key))
+			table_delete(table, entry->key);
+	}
+	return to;
+}
+
+#endif
@@ -0,0 +1,335 @@
+#include "common.h"
+
+#ifdef TABLE_SWISS
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+// Every slot has a control byte: EMPTY, DELETED, or the low 7 bits of the
+// key's hash when full. Lookups compare a whole group of control bytes at
+// once and only touch entries whose fragment matches.
+#define TABLE_MAX_LOAD 0.875
+#define TABLE_MIN_LOAD 0.25
+#define GROUP_SIZE 16
+
+#define CONTROL_EMPTY ((uint8_t)0x80)
+#define CONTROL_DELETED ((uint8_t)0xfe)
+#define IS_FULL(control) (((control) & 0x80) == 0)
+
+#define HASH_GROUP(hash) ((hash) >> 7)
+#define HASH_FRAGMENT(hash) ((uint8_t)((hash) & 0x7f))
+
+#define GROW_TABLE(capacity) \
+	((capacity) < GROUP_SIZE ? GROUP_SIZE : (capacity) * 2)
+
+extern VM vm;
+
+
+typedef struct {
+	uint32_t mask;
+	uint32_t group;
+	uint32_t step;
+} Probe;
+
+
+static Probe probe_start(Table* table, uint32_t hash) {
+	Probe probe;
+	probe.mask = (uint32_t)table->capacity / GROUP_SIZE - 1;
+	probe.group = HASH_GROUP(hash) & probe.mask;
+	probe.step = 0;
+	return probe;
+}
+
+
+// Triangular steps visit every group once the group count is a power of two.
+static void probe_next(Probe* probe) {
+	probe->step++;
+	probe->group = (probe->group + probe->step) & probe->mask;
+}
+
+
+#ifdef __SSE2__
+static uint32_t group_match(const uint8_t* control, uint8_t fragment) {
+	__m128i group = _mm_loadu_si128((const __m128i*)control);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)fragment)));
+}
+
+// EMPTY and DELETED are the only control bytes with the high bit set.
+static uint32_t group_match_free(const uint8_t* control) {
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)control));
+}
+#else
+static uint32_t group_match(const uint8_t* control, uint8_t fragment) {
+	uint32_t bits = 0;
+	for (int i = 0; i < GROUP_SIZE; i++)
+		bits |= (uint32_t)(control[i] == fragment) << i;
+	return bits;
+}
+
+static uint32_t group_match_free(const uint8_t* control) {
+	uint32_t bits = 0;
+	for (int i = 0; i < GROUP_SIZE; i++)
+		bits |= (uint32_t)(control[i] >> 7) << i;
+	return bits;
+}
+#endif
+
+
+static int lowest_bit(uint32_t bits) {
+#ifdef __GNUC__
+	return __builtin_ctz(bits);
+#else
+	int bit = 0;
+	while ((bits & 1) == 0) {
+		bits >>= 1;
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+
+Table table_create() {
+	Table table;
+	table.count = 0;
+	table.tombstones = 0;
+	table.capacity = 0;
+	table.entries = NULL;
+	table.control = NULL;
+	table.version = 1;
+	return table;
+}
+
+
+void table_free(Table *table) {
+	FREE_ARRAY(Entry, table->entries, table->capacity);
+	FREE_ARRAY(uint8_t, table->control, table->capacity);
+	table->count = 0;
+	table->tombstones = 0;
+	table->capacity = 0;
+	table->entries = NULL;
+	table->control = NULL;
+	table->version++;
+}
+
+
+static int slot_find(Table* table, ObjString* key) {
+	if (table->count == 0) return -1;
+
+	uint8_t fragment = HASH_FRAGMENT(key->hash);
+	for (Probe probe = probe_start(table, key->hash);; probe_next(&probe)) {
+		int base = (int)probe.group * GROUP_SIZE;
+		const uint8_t* control = &table->control[base];
+		for (uint32_t bits = group_match(control, fragment); bits != 0; bits &= bits - 1) {
+			int slot = base + lowest_bit(bits);
+			if (table->entries[slot].key == key)
+				return slot;
+		}
+		if (group_match(control, CONTROL_EMPTY) != 0)
+			return -1;
+	}
+}
+
+
+static int slot_free(Table* table, uint32_t hash) {
+	for (Probe probe = probe_start(table, hash);; probe_next(&probe)) {
+		int base = (int)probe.group * GROUP_SIZE;
+		uint32_t bits = group_match_free(&table->control[base]);
+		if (bits != 0)
+			return base + lowest_bit(bits);
+	}
+}
+
+
+static void adjust_capacity(Table* table, int capacity) {
+	Entry* entries = ALLOCATE(Entry, capacity);
+	uint8_t* control = ALLOCATE(uint8_t, capacity);
+	memset(control, CONTROL_EMPTY, capacity);
+
+	Table resized = *table;
+	resized.entries = entries;
+	resized.control = control;
+	resized.capacity = capacity;
+	resized.count = 0;
+	resized.tombstones = 0;
+
+	for (int i = 0; i < table->capacity; i++) {
+		if (!IS_FULL(table->control[i])) continue;
+
+		Entry* entry = &table->entries[i];
+		int slot = slot_free(&resized, entry->key->hash);
+		resized.control[slot] = table->control[i];
+		resized.entries[slot] = *entry;
+		resized.count++;
+	}
+
+	FREE_ARRAY(Entry, table->entries, table->capacity);
+	FREE_ARRAY(uint8_t, table->control, table->capacity);
+
+	table->entries = resized.entries;
+	table->control = resized.control;
+	table->capacity = capacity;
+	table->count = resized.count;
+	table->tombstones = 0;
+	table->version++;
+}
+
+
+bool table_insert(Table* table, ObjString* key, Value value) {
+	int slot = slot_find(table, key);
+	if (slot >= 0) {
+		table->entries[slot].value = value;
+		return false;
+	}
+
+	if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+		adjust_capacity(table, GROW_TABLE(table->capacity));
+
+	slot = slot_free(table, key->hash);
+	if (table->control[slot] == CONTROL_DELETED)
+		table->tombstones--;
+	else
+		table->count++;
+	table->control[slot] = HASH_FRAGMENT(key->hash);
+	table->entries[slot].key = key;
+	table->entries[slot].value = value;
+	return true;
+}
+
+
+void table_add_all(Table *from, Table *to) {
+	for (int i = 0; i < from->capacity; i++) {
+		if (IS_FULL(from->control[i]))
+			table_insert(to, from->entries[i].key, from->entries[i].value);
+	}
+}
+
+
+bool table_get(Table *table, ObjString *key, Value *value) {
+	int slot = slot_find(table, key);
+	if (slot < 0) return false;
+
+	*value = table->entries[slot].value;
+	return true;
+}
+
+
+Entry* table_find_entry(Table* table, ObjString* key) {
+	int slot = slot_find(table, key);
+	return slot < 0 ? NULL : &table->entries[slot];
+}
+
+
+bool table_delete(Table *table, ObjString *key) {
+	int slot = slot_find(table, key);
+	if (slot < 0) return false;
+
+	table->control[slot] = CONTROL_DELETED;
+	table->entries[slot].key = NULL;
+	table->entries[slot].value = VALUE_NIL;
+	table->tombstones++;
+	table->version++;
+	return true;
+}
+
+
+// Shrinks a table whose load has fallen below TABLE_MIN_LOAD, or rehashes it
+// in place once tombstones take up a quarter of it.
+bool table_compact(Table* table) {
+	if (table->capacity == 0)
+		return false;
+
+	int live = table->count - table->tombstones;
+	int capacity = table->capacity;
+	while (capacity > GROUP_SIZE && live < capacity * TABLE_MIN_LOAD)
+		capacity /= 2;
+
+	if (capacity == table->capacity && table->tombstones < table->capacity * TABLE_MIN_LOAD)
+		return false;
+	adjust_capacity(table, capacity);
+	return true;
+}
+
+
+// Probe lengths are counted in groups rather than slots.
+TableStats table_stats(Table* table) {
+	TableStats stats;
+	stats.capacity = table->capacity;
+	stats.live = table->count - table->tombstones;
+	stats.tombstones = table->tombstones;
+	stats.max_probe = 0;
+
+	long probes = 0;
+	for (int i = 0; i < table->capacity; i++) {
+		if (!IS_FULL(table->control[i])) continue;
+
+		int probe = 1;
+		for (Probe p = probe_start(table, table->entries[i].key->hash);
+			p.group != (uint32_t)(i / GROUP_SIZE); probe_next(&p))
+			probe++;
+		probes += probe;
+		if (probe > stats.max_probe)
+			stats.max_probe = probe;
+	}
+	stats.average_probe = stats.live > 0 ? (double)probes / stats.live : 0.0;
+	return stats;
+}
+
+
+ObjString* table_find_string(Table *table, const char *chars, int length, uint32_t hash) {
+	if (table->count == 0) return NULL;
+
+	uint8_t fragment = HASH_FRAGMENT(hash);
+	for (Probe probe = probe_start(table, hash);; probe_next(&probe)) {
+		int base = (int)probe.group * GROUP_SIZE;
+		const uint8_t* control = &table->control[base];
+		for (uint32_t bits = group_match(control, fragment); bits != 0; bits &= bits - 1) {
+			ObjString* key = table->entries[base + lowest_bit(bits)].key;
+			if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0)
+				return key;
+		}
+		if (group_match(control, CONTROL_EMPTY) != 0)
+			return NULL;
+	}
+}
+
+
+static int table_range_end(Table* table, int from, size_t budget) {
+	return budget < (size_t)(table->capacity - from) ? from + (int)budget : table->capacity;
+}
+
+
+int table_mark(Table* table, int from, size_t budget) {
+	int to = table_range_end(table, from, budget);
+	for (int i = from; i < to; i++) {
+		if (!IS_FULL(table->control[i])) continue;
+		gc_mark_object((Obj*)table->entries[i].key);
+		gc_mark_value(table->entries[i].value);
+	}
+	return to;
+}
+
+
+int table_remove_white(Table* table, int from, size_t budget) {
+	int to = table_range_end(table, from, budget);
+	for (int i = from; i < to; i++) {
+		Entry* entry = &table->entries[i];
+		if (IS_FULL(table->control[i]) && !IS_MARKED((Obj*)entry->key))
+			table_delete(table, entry->key);
+	}
+	return to;
+}
+
+#endif
@@ -34,22 +34,23 @@ void value_array_free(ValueArray* array) {
 }
 
 void value_print(Value value) {
-	switch (value.type) {
-	case VAL_BOOL:
+	if (IS_BOOL(value)) {
 		printf("%s", AS_BOOL(value) ? "true" : "false");
-		break;
-	case VAL_NIL:
-		printf("nil"); break;
-	case VAL_NUMBER:
+	} else if (IS_NIL(value)) {
+		printf("nil");
+	} else if (IS_NUMBER(value)) {
 		printf("%g", AS_NUMBER(value));
-		break;
-	case VAL_OBJ:
+	} else if (IS_OBJECT(value)) {
 		object_print(value);
-		break;
 	}
 }
 
 bool value_equal(Value left, Value right) {
+#ifdef NAN_BOXING
+	if (IS_NUMBER(left) && IS_NUMBER(right))
+		return AS_NUMBER(left) == AS_NUMBER(right);
+	return left == right;
+#else
 	if (left.type != right.type) return false;
 	switch (left.type) {
 	case VAL_BOOL: return AS_BOOL(left) == AS_BOOL(right);
@@ -58,4 +59,5 @@ bool value_equal(Value left, Value right) {
 	case VAL_OBJ: return AS_OBJECT(left) == AS_OBJECT(right);
 	default: return false;
 	}
+#endif
 }
@@ -4,6 +4,8 @@
 #include "debug.h"
 #include "memory.h"
 #include "object.h"
+#include "options.h"
+#include "profile.h"
 #include "table.h"
 #include "value.h"
 #include <stdarg.h>
@@ -11,12 +13,23 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "vm.h"
 
 
 VM vm;
 
+extern Options options;
+
+#ifdef QUICKENING
+// Rewrites of generic instructions into specialized ones, guard failures
+// that turned them back, and sites pinned to the generic form.
+static uint64_t quickenings[OPCODE_COUNT];
+static uint64_t guard_failures[OPCODE_COUNT];
+static uint64_t pinned_sites[OPCODE_COUNT];
+#endif
+
 static void reset_stack() {
 	vm.stack_top = vm.stack;
 }
@@ -24,23 +37,45 @@ static void reset_stack() {
 
 void vm_create() {
 	reset_stack();
+	vm.chunk = NULL;
 	vm.objects = NULL;
+	vm.bytes_allocated = 0;
+	vm.next_gc = GC_HEAP_MIN;
+	vm.gc_state = GC_IDLE;
+	vm.gc_mark = true;
+	vm.gc_sweep = NULL;
+	vm.gray_count = 0;
+	vm.gray_capacity = 0;
+	vm.gray_stack = NULL;
+	vm.profiling = options.profile || options.profile_pairs;
+	vm.tracing = options.trace;
 	vm.strings = table_create();
 	vm.globals = table_create();
+#ifdef GLOBAL_SLOTS
+	vm.global_values = value_array_create();
+	vm.global_names = value_array_create();
+#elif defined(GLOBAL_CACHE)
+	vm.global_caches = NULL;
+#endif
+#ifdef QUICKENING
+	vm.guard_misses = NULL;
+#endif
 }
 
 
 void vm_free() {
 	table_free(&vm.strings);
 	table_free(&vm.globals);
+#ifdef GLOBAL_SLOTS
+	value_array_free(&vm.global_values);
+	value_array_free(&vm.global_names);
+#endif
 	objects_free();
+	pools_free();
+	free(vm.gray_stack);
+	vm.gray_stack = NULL;
 }
 
-static Value peek(int distance) {
-	return vm.stack_top[-1 - distance];
-}
-
-
 static void error_runtime(const char* format, ...) {
 	va_list args;
 	va_start(args, format);
@@ -49,145 +84,499 @@ static void error_runtime(const char* format, ...) {
 	fputs("\n", stderr);
 
 	size_t instruction = vm.ip - vm.chunk->code - 1;
-	int line = vm.chunk->lines[instruction];
+	int line = chunk_get_line(vm.chunk, (int)instruction);
 	fprintf(stderr, "[line %d] in script\n", line);
 	reset_stack();
 }
 
-static bool is_falsy(Value value) {
-	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+#ifdef GLOBAL_SLOTS
+int vm_global_slot(ObjString* name) {
+	Value slot;
+	if (table_get(&vm.globals, name, &slot))
+		return (int)AS_NUMBER(slot);
+
+	int index = vm.global_values.count;
+	vm_push(VALUE_OBJECT(name));
+	value_array_write(&vm.global_values, VALUE_UNDEFINED);
+	value_array_write(&vm.global_names, VALUE_OBJECT(name));
+	table_insert(&vm.globals, name, VALUE_NUMBER(index));
+	GC_BARRIER(VALUE_OBJECT(name));
+	vm_pop();
+	return index;
 }
 
 
-static void concatenate() {
-	ObjString* b = AS_STRING(vm_pop());
-	ObjString* a = AS_STRING(vm_pop());
+ObjString* vm_global_name(int slot) {
+	return AS_STRING(vm.global_names.values[slot]);
+}
+#elif defined(GLOBAL_CACHE)
+// One cache per name constant, so every use of a name in the chunk shares
+// it. Only hits are cached: defining a missing global doesn't move entries
+// or bump the version.
+static Entry* global_lookup(int index) {
+	GlobalCache* cache = &vm.global_caches[index];
+	if (cache->entry != NULL && cache->version == vm.globals.version)
+		return cache->entry;
+
+	ObjString* name = AS_STRING(vm.chunk->constants.values[index]);
+	cache->entry = table_find_entry(&vm.globals, name);
+	cache->version = vm.globals.version;
+	return cache->entry;
+}
+#else
+static Entry* global_lookup(int index) {
+	ObjString* name = AS_STRING(vm.chunk->constants.values[index]);
+	return table_find_entry(&vm.globals, name);
+}
+#endif
 
-	int length = a->length + b->length;
-	char* chars = ALLOCATE(char, length + 1);
-	memcpy(chars, a->chars, a->length);
-	memcpy(chars + a->length, b->chars, b->length);
-	chars[length] = '\0';
+#ifdef QUICKENING
+#define QUICKEN_MAX_MISSES 4
 
-	ObjString* result = take_string(chars, length);
-	vm_push(VALUE_OBJECT(result));
+// A polymorphic site would flip between specialized forms on every run, so
+// after QUICKEN_MAX_MISSES guard failures it stays generic. The per-offset
+// counters are only allocated once some guard fails.
+static bool site_is_pinned(int offset) {
+	return vm.guard_misses != NULL && vm.guard_misses[offset] >= QUICKEN_MAX_MISSES;
 }
 
+
+static void site_missed(int offset, OpCode generic) {
+	if (vm.guard_misses == NULL) {
+		vm.guard_misses = calloc(vm.chunk->count, sizeof(uint8_t));
+		if (vm.guard_misses == NULL) exit(1);
+	}
+	if (++vm.guard_misses[offset] == QUICKEN_MAX_MISSES)
+		pinned_sites[generic]++;
+}
+#endif
+
+static bool is_falsy(Value value) {
+	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void trace_execution() {
+	printf("          ");
+	for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+		printf("[ ");
+		value_print(*slot);
+		printf(" ]");
+	}
+	printf("\n");
+	disassemble_instruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+}
+#define TRACE_EXECUTION() \
+	do { \
+		if (vm.tracing) \
+			(SYNC(), trace_execution()); \
+	} while (false)
+#else
+#define TRACE_EXECUTION() ((void)0)
+#endif
+
+
 static InterpretResult run() {
-#define READ_BYTE() (*vm.ip++)
+	uint8_t* ip = vm.ip;
+	Value* stack_top = vm.stack_top;
+	int operand;
+
+#define SYNC() (vm.ip = ip, vm.stack_top = stack_top)
+#define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-#define READ_STRING() (AS_STRING(READ_CONSTANT()))
-#define BINARY_OP(value_type, op) \
+#define READ_LONG() (ip += 3, ip[-3] | ip[-2] << 8 | ip[-1] << 16)
+#define PUSH(value) (*stack_top++ = (value))
+#define POP() (*--stack_top)
+#define DROP() (stack_top--)
+#define PEEK(distance) (stack_top[-1 - (distance)])
+#define FLATTEN(distance) \
 	do { \
-		if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-			error_runtime("Operands must be numbers."); \
-			return INTERPRET_RUNTIME_ERROR; \
+		if (IS_ROPE(PEEK(distance))) { \
+			SYNC(); \
+			PEEK(distance) = VALUE_OBJECT(string_flatten(PEEK(distance))); \
 		} \
-		double b = AS_NUMBER(vm_pop()); \
-		double a = AS_NUMBER(vm_pop()); \
-		vm_push(value_type(a op b)); \
 	} while (false)
+#define RUNTIME_ERROR(...) \
+	do { \
+		SYNC(); \
+		error_runtime(__VA_ARGS__); \
+		return INTERPRET_RUNTIME_ERROR; \
+	} while (false)
+#define BINARY_OP(value_type, op) \
+	do { \
+		if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) \
+			RUNTIME_ERROR("Operands must be numbers."); \
+		double b = AS_NUMBER(POP()); \
+		double a = AS_NUMBER(POP()); \
+		PUSH(value_type(a op b)); \
+	} while (false)
+#define BINARY_CONSTANT_OP(value_type, op) \
+	do { \
+		Value b = READ_CONSTANT(); \
+		if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(b)) \
+			RUNTIME_ERROR("Operands must be numbers."); \
+		PEEK(0) = value_type(AS_NUMBER(PEEK(0)) op AS_NUMBER(b)); \
+	} while (false)
+// The negated comparisons keep `!(a < b)` semantics, so NaN compares the
+// same with and without -O.
+#define VALUE_NOT_BOOL(value) VALUE_BOOL(!(value))
 
+#ifdef QUICKENING
+#define QUICKEN(length, op) \
+	do { \
+		if (!site_is_pinned((int)(ip - (length) - vm.chunk->code))) \
+			(ip[-(length)] = (op), quickenings[op]++); \
+	} while (false)
+// Turns a specialized instruction back into its generic form and re-runs it.
+#define DEOPTIMIZE(op) \
+	(site_missed((int)(ip - 1 - vm.chunk->code), (op)), \
+		guard_failures[ip[-1]]++, ip[-1] = (op), ip--)
+#else
+#define QUICKEN(length, op) ((void)0)
+#define DEOPTIMIZE(op) (ip[-1] = (op), ip--)
+#endif
+
+#ifdef PROFILE_EXECUTION
+#define PROFILE_INSTRUCTION() \
+	do { \
+		if (vm.profiling) \
+			(SYNC(), profile_instruction(vm.chunk, (int)(ip - vm.chunk->code))); \
+	} while (false)
+#else
+#define PROFILE_INSTRUCTION() ((void)0)
+#endif
+
+#ifdef COMPUTED_GOTO
+	static void* dispatch_table[] = {
+		[OP_RETURN] = &&L_OP_RETURN,
+		[OP_CONSTANT] = &&L_OP_CONSTANT,
+		[OP_NIL] = &&L_OP_NIL,
+		[OP_TRUE] = &&L_OP_TRUE,
+		[OP_FALSE] = &&L_OP_FALSE,
+		[OP_NEGATE] = &&L_OP_NEGATE,
+		[OP_NOT] = &&L_OP_NOT,
+		[OP_ADD] = &&L_OP_ADD,
+		[OP_SUBTRACT] = &&L_OP_SUBTRACT,
+		[OP_MULTIPLY] = &&L_OP_MULTIPLY,
+		[OP_DIVIDE] = &&L_OP_DIVIDE,
+		[OP_EQUAL] = &&L_OP_EQUAL,
+		[OP_NOT_EQUAL] = &&L_OP_NOT_EQUAL,
+		[OP_GREATER] = &&L_OP_GREATER,
+		[OP_LESS] = &&L_OP_LESS,
+		[OP_PRINT] = &&L_OP_PRINT,
+		[OP_POP] = &&L_OP_POP,
+		[OP_DEFINE_GLOBAL] = &&L_OP_DEFINE_GLOBAL,
+		[OP_GET_GLOBAL] = &&L_OP_GET_GLOBAL,
+		[OP_SET_GLOBAL] = &&L_OP_SET_GLOBAL,
+		[OP_ADD_CONSTANT] = &&L_OP_ADD_CONSTANT,
+		[OP_EQUAL_CONSTANT] = &&L_OP_EQUAL_CONSTANT,
+		[OP_GREATER_CONSTANT] = &&L_OP_GREATER_CONSTANT,
+		[OP_LESS_CONSTANT] = &&L_OP_LESS_CONSTANT,
+		[OP_SET_GLOBAL_POP] = &&L_OP_SET_GLOBAL_POP,
+		[OP_CONSTANT_LONG] = &&L_OP_CONSTANT_LONG,
+		[OP_DEFINE_GLOBAL_LONG] = &&L_OP_DEFINE_GLOBAL_LONG,
+		[OP_GET_GLOBAL_LONG] = &&L_OP_GET_GLOBAL_LONG,
+		[OP_SET_GLOBAL_LONG] = &&L_OP_SET_GLOBAL_LONG,
+		[OP_SET_GLOBAL_POP_LONG] = &&L_OP_SET_GLOBAL_POP_LONG,
+		[OP_ADD_NUM] = &&L_OP_ADD_NUM,
+		[OP_ADD_STR] = &&L_OP_ADD_STR,
+		[OP_ADD_CONSTANT_NUM] = &&L_OP_ADD_CONSTANT_NUM,
+		[OP_ADD_CONSTANT_STR] = &&L_OP_ADD_CONSTANT_STR,
+		[OP_NOT_EQUAL_CONSTANT] = &&L_OP_NOT_EQUAL_CONSTANT,
+		[OP_NOT_GREATER_CONSTANT] = &&L_OP_NOT_GREATER_CONSTANT,
+		[OP_NOT_LESS_CONSTANT] = &&L_OP_NOT_LESS_CONSTANT,
+	};
+
+#define CASE(op) case op: L_##op
+#define DISPATCH() \
+	do { \
+		TRACE_EXECUTION(); \
+		PROFILE_INSTRUCTION(); \
+		goto *dispatch_table[READ_BYTE()]; \
+	} while (false)
+#else
+#define CASE(op) case op
+#define DISPATCH() break
+#endif
 
-	for (;;) {
 
-		#ifdef DEBUG_TRACE_EXECUTION
-		printf("          ");
-		for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
-			printf("[ ");
-			value_print(*slot);
-			printf(" ]");
-		}
-		printf("\n");
-		disassemble_instruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
-		#endif
+	for (;;) {
+		TRACE_EXECUTION();
+		PROFILE_INSTRUCTION();
 
-		uint8_t instruction;
-		switch (instruction = READ_BYTE()) {
-			case OP_RETURN: {
+		switch (READ_BYTE()) {
+			CASE(OP_RETURN): {
+				SYNC();
 				return INTERPRET_OK;
 			}
-			case OP_NEGATE: {
-				if (!IS_NUMBER(peek(0))) {
-					error_runtime("Operand must be a number.");
-					return INTERPRET_RUNTIME_ERROR;
-				}
-				vm_push(VALUE_NUMBER(-AS_NUMBER(vm_pop())));
-				break;
-			}
-			case OP_NOT:
-				vm_push(VALUE_BOOL(is_falsy(vm_pop())));
-				break;
-			case OP_ADD: {
-				if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-					concatenate();
-				} else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-					double b = AS_NUMBER(vm_pop());
-					double a = AS_NUMBER(vm_pop());
-					vm_push(VALUE_NUMBER(a + b));
+			CASE(OP_NEGATE): {
+				if (!IS_NUMBER(PEEK(0)))
+					RUNTIME_ERROR("Operand must be a number.");
+				PEEK(0) = VALUE_NUMBER(-AS_NUMBER(PEEK(0)));
+				DISPATCH();
+			}
+			CASE(OP_NOT):
+				PEEK(0) = VALUE_BOOL(is_falsy(PEEK(0)));
+				DISPATCH();
+			CASE(OP_ADD): {
+				if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+					QUICKEN(1, OP_ADD_NUM);
+					double b = AS_NUMBER(POP());
+					double a = AS_NUMBER(POP());
+					PUSH(VALUE_NUMBER(a + b));
+				} else if (IS_TEXT(PEEK(0)) && IS_TEXT(PEEK(1))) {
+					QUICKEN(1, OP_ADD_STR);
+					SYNC();
+					Value result = string_concatenate(PEEK(1), PEEK(0));
+					stack_top -= 2;
+					PUSH(result);
 				} else {
-					error_runtime("Operands must be two numbers or two strings.");
-					return INTERPRET_RUNTIME_ERROR;
+					RUNTIME_ERROR("Operands must be two numbers or two strings.");
+				}
+				DISPATCH();
+			}
+			CASE(OP_ADD_NUM): {
+				if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+					DEOPTIMIZE(OP_ADD);
+					DISPATCH();
+				}
+				double b = AS_NUMBER(POP());
+				PEEK(0) = VALUE_NUMBER(AS_NUMBER(PEEK(0)) + b);
+				DISPATCH();
+			}
+			CASE(OP_ADD_STR): {
+				if (!IS_TEXT(PEEK(0)) || !IS_TEXT(PEEK(1))) {
+					DEOPTIMIZE(OP_ADD);
+					DISPATCH();
 				}
-				break;
+				SYNC();
+				Value result = string_concatenate(PEEK(1), PEEK(0));
+				stack_top -= 2;
+				PUSH(result);
+				DISPATCH();
 			}
-			case OP_SUBTRACT: BINARY_OP(VALUE_NUMBER, -); break;
-			case OP_MULTIPLY: BINARY_OP(VALUE_NUMBER, *); break;
-			case OP_DIVIDE: BINARY_OP(VALUE_NUMBER, /); break;
-			case OP_CONSTANT: {
+			CASE(OP_SUBTRACT): BINARY_OP(VALUE_NUMBER, -); DISPATCH();
+			CASE(OP_MULTIPLY): BINARY_OP(VALUE_NUMBER, *); DISPATCH();
+			CASE(OP_DIVIDE): BINARY_OP(VALUE_NUMBER, /); DISPATCH();
+			CASE(OP_CONSTANT): {
 				Value constant = READ_CONSTANT();
-				vm_push(constant);
-				break;
-			}
-			case OP_NIL: vm_push(VALUE_NIL); break;
-			case OP_TRUE: vm_push(VALUE_BOOL(true)); break;
-			case OP_FALSE: vm_push(VALUE_BOOL(false)); break;
-			case OP_EQUAL: {
-				Value b = vm_pop();
-				Value a = vm_pop();
-				vm_push(VALUE_BOOL(value_equal(a, b)));
-				break;
-			}
-			case OP_GREATER: BINARY_OP(VALUE_NUMBER, >); break;
-			case OP_LESS: BINARY_OP(VALUE_NUMBER, <); break;
-			case OP_GET_GLOBAL: {
-				ObjString* name = READ_STRING();
-				Value value;
-				if (!table_get(&vm.globals, name, &value)) {
-					error_runtime("Undefined variable '%s'", name->chars);
-					return INTERPRET_RUNTIME_ERROR;
+				PUSH(constant);
+				DISPATCH();
+			}
+			CASE(OP_CONSTANT_LONG): {
+				Value constant = vm.chunk->constants.values[READ_LONG()];
+				PUSH(constant);
+				DISPATCH();
+			}
+			CASE(OP_NIL): PUSH(VALUE_NIL); DISPATCH();
+			CASE(OP_TRUE): PUSH(VALUE_BOOL(true)); DISPATCH();
+			CASE(OP_FALSE): PUSH(VALUE_BOOL(false)); DISPATCH();
+			CASE(OP_EQUAL): {
+				FLATTEN(0);
+				FLATTEN(1);
+				Value b = POP();
+				Value a = POP();
+				PUSH(VALUE_BOOL(value_equal(a, b)));
+				DISPATCH();
+			}
+			CASE(OP_NOT_EQUAL): {
+				FLATTEN(0);
+				FLATTEN(1);
+				Value b = POP();
+				Value a = POP();
+				PUSH(VALUE_BOOL(!value_equal(a, b)));
+				DISPATCH();
+			}
+			CASE(OP_GREATER): BINARY_OP(VALUE_BOOL, >); DISPATCH();
+			CASE(OP_LESS): BINARY_OP(VALUE_BOOL, <); DISPATCH();
+#ifdef GLOBAL_SLOTS
+			CASE(OP_GET_GLOBAL_LONG):
+				operand = READ_LONG();
+				goto get_global;
+			CASE(OP_GET_GLOBAL):
+				operand = READ_BYTE();
+			get_global: {
+				int slot = operand;
+				Value value = vm.global_values.values[slot];
+				if (IS_UNDEFINED(value))
+					RUNTIME_ERROR("Undefined variable '%s'", vm_global_name(slot)->chars);
+				PUSH(value);
+				DISPATCH();
+			}
+			CASE(OP_DEFINE_GLOBAL_LONG):
+				operand = READ_LONG();
+				goto define_global;
+			CASE(OP_DEFINE_GLOBAL):
+				operand = READ_BYTE();
+			define_global: {
+				int slot = operand;
+				vm.global_values.values[slot] = POP();
+				GC_BARRIER(vm.global_values.values[slot]);
+				DISPATCH();
+			}
+			CASE(OP_SET_GLOBAL_LONG):
+				operand = READ_LONG();
+				goto set_global;
+			CASE(OP_SET_GLOBAL):
+				operand = READ_BYTE();
+			set_global: {
+				int slot = operand;
+				if (IS_UNDEFINED(vm.global_values.values[slot]))
+					RUNTIME_ERROR("Undefined variable '%s'.", vm_global_name(slot)->chars);
+				vm.global_values.values[slot] = PEEK(0);
+				GC_BARRIER(PEEK(0));
+				DISPATCH();
+			}
+			CASE(OP_SET_GLOBAL_POP_LONG):
+				operand = READ_LONG();
+				goto set_global_pop;
+			CASE(OP_SET_GLOBAL_POP):
+				operand = READ_BYTE();
+			set_global_pop: {
+				int slot = operand;
+				if (IS_UNDEFINED(vm.global_values.values[slot]))
+					RUNTIME_ERROR("Undefined variable '%s'.", vm_global_name(slot)->chars);
+				vm.global_values.values[slot] = POP();
+				GC_BARRIER(vm.global_values.values[slot]);
+				DISPATCH();
+			}
+#else
+			CASE(OP_GET_GLOBAL_LONG):
+				operand = READ_LONG();
+				goto get_global;
+			CASE(OP_GET_GLOBAL):
+				operand = READ_BYTE();
+			get_global: {
+				int index = operand;
+				Entry* entry = global_lookup(index);
+				if (entry == NULL)
+					RUNTIME_ERROR("Undefined variable '%s'", AS_CSTRING(vm.chunk->constants.values[index]));
+				PUSH(entry->value);
+				DISPATCH();
+			}
+			CASE(OP_DEFINE_GLOBAL_LONG):
+				operand = READ_LONG();
+				goto define_global;
+			CASE(OP_DEFINE_GLOBAL):
+				operand = READ_BYTE();
+			define_global: {
+				ObjString* name = AS_STRING(vm.chunk->constants.values[operand]);
+				SYNC();
+				table_insert(&vm.globals, name, PEEK(0));
+				GC_BARRIER(VALUE_OBJECT(name));
+				GC_BARRIER(PEEK(0));
+				DROP();
+				DISPATCH();
+			}
+			CASE(OP_SET_GLOBAL_LONG):
+				operand = READ_LONG();
+				goto set_global;
+			CASE(OP_SET_GLOBAL):
+				operand = READ_BYTE();
+			set_global: {
+				int index = operand;
+				Entry* entry = global_lookup(index);
+				if (entry == NULL)
+					RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm.chunk->constants.values[index]));
+				entry->value = PEEK(0);
+				GC_BARRIER(PEEK(0));
+				DISPATCH();
+			}
+			CASE(OP_SET_GLOBAL_POP_LONG):
+				operand = READ_LONG();
+				goto set_global_pop;
+			CASE(OP_SET_GLOBAL_POP):
+				operand = READ_BYTE();
+			set_global_pop: {
+				int index = operand;
+				Entry* entry = global_lookup(index);
+				if (entry == NULL)
+					RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm.chunk->constants.values[index]));
+				entry->value = POP();
+				GC_BARRIER(entry->value);
+				DISPATCH();
+			}
+#endif
+			CASE(OP_ADD_CONSTANT): {
+				Value b = READ_CONSTANT();
+				Value a = PEEK(0);
+				if (IS_NUMBER(a) && IS_NUMBER(b)) {
+					QUICKEN(2, OP_ADD_CONSTANT_NUM);
+					PEEK(0) = VALUE_NUMBER(AS_NUMBER(a) + AS_NUMBER(b));
+				} else if (IS_TEXT(a) && IS_STRING(b)) {
+					QUICKEN(2, OP_ADD_CONSTANT_STR);
+					SYNC();
+					PEEK(0) = string_concatenate(a, b);
+				} else {
+					RUNTIME_ERROR("Operands must be two numbers or two strings.");
 				}
-				vm_push(value);
-				break;
-			}
-			case OP_DEFINE_GLOBAL: {
-				ObjString* name = READ_STRING();
-				table_insert(&vm.globals, name, peek(0));
-				vm_pop();
-				break;
-			}
-			case OP_SET_GLOBAL: {
-				ObjString* name = READ_STRING();
-				if (table_insert(&vm.globals, name, peek(0))) {
-					table_delete(&vm.globals, name);
-					error_runtime("Undefined variable '%s'.", name->chars);
-					return INTERPRET_RUNTIME_ERROR;
+				DISPATCH();
+			}
+			// A constant's type never changes, so only the stack operand is guarded.
+			CASE(OP_ADD_CONSTANT_NUM): {
+				if (!IS_NUMBER(PEEK(0))) {
+					DEOPTIMIZE(OP_ADD_CONSTANT);
+					DISPATCH();
 				}
-				break;
+				Value b = READ_CONSTANT();
+				PEEK(0) = VALUE_NUMBER(AS_NUMBER(PEEK(0)) + AS_NUMBER(b));
+				DISPATCH();
+			}
+			CASE(OP_ADD_CONSTANT_STR): {
+				if (!IS_TEXT(PEEK(0))) {
+					DEOPTIMIZE(OP_ADD_CONSTANT);
+					DISPATCH();
+				}
+				Value b = READ_CONSTANT();
+				SYNC();
+				PEEK(0) = string_concatenate(PEEK(0), b);
+				DISPATCH();
+			}
+			CASE(OP_EQUAL_CONSTANT): {
+				FLATTEN(0);
+				Value b = READ_CONSTANT();
+				PEEK(0) = VALUE_BOOL(value_equal(PEEK(0), b));
+				DISPATCH();
 			}
-			case OP_POP: vm_pop(); break;
-			case OP_PRINT: {
-				value_print(vm_pop());
+			CASE(OP_GREATER_CONSTANT): BINARY_CONSTANT_OP(VALUE_BOOL, >); DISPATCH();
+			CASE(OP_LESS_CONSTANT): BINARY_CONSTANT_OP(VALUE_BOOL, <); DISPATCH();
+			CASE(OP_NOT_EQUAL_CONSTANT): {
+				FLATTEN(0);
+				Value b = READ_CONSTANT();
+				PEEK(0) = VALUE_BOOL(!value_equal(PEEK(0), b));
+				DISPATCH();
+			}
+			CASE(OP_NOT_GREATER_CONSTANT): BINARY_CONSTANT_OP(VALUE_NOT_BOOL, >); DISPATCH();
+			CASE(OP_NOT_LESS_CONSTANT): BINARY_CONSTANT_OP(VALUE_NOT_BOOL, <); DISPATCH();
+			CASE(OP_POP): DROP(); DISPATCH();
+			CASE(OP_PRINT): {
+				FLATTEN(0);
+				value_print(POP());
 				printf("\n");
-				break;
+				DISPATCH();
 			}
 		}
 	}
 
+#undef DISPATCH
+#undef CASE
+#undef PROFILE_INSTRUCTION
+#undef DEOPTIMIZE
+#undef QUICKEN
+#undef VALUE_NOT_BOOL
+#undef BINARY_CONSTANT_OP
 #undef BINARY_OP
-#undef READ_STRING
-#undef READ_BYTE
+#undef RUNTIME_ERROR
+#undef FLATTEN
+#undef PEEK
+#undef POP
+#undef DROP
+#undef PUSH
+#undef READ_LONG
 #undef READ_CONSTANT
+#undef READ_BYTE
+#undef SYNC
 }
 
 
@@ -199,15 +588,53 @@ InterpretResult vm_interpret(const char* source) {
 		return INTERPRET_COMPILE_ERROR;
 	}
 
-	vm.chunk = &chunk;
+	InterpretResult result = vm_interpret_chunk(&chunk);
+	chunk_free(&chunk);
+
+	return result;
+}
+
+
+InterpretResult vm_interpret_chunk(Chunk* chunk) {
+	vm.chunk = chunk;
 	vm.ip = vm.chunk->code;
 
+#if defined(GLOBAL_CACHE) && !defined(GLOBAL_SLOTS)
+	vm.global_caches = calloc(chunk->constants.count, sizeof(GlobalCache));
+	if (vm.global_caches == NULL && chunk->constants.count > 0)
+		exit(1);
+#endif
+
 	InterpretResult result = run();
+#ifdef PROFILE_EXECUTION
+	if (vm.profiling)
+		profile_chunk_end();
+#endif
+
+#if defined(GLOBAL_CACHE) && !defined(GLOBAL_SLOTS)
+	free(vm.global_caches);
+	vm.global_caches = NULL;
+#endif
+#ifdef QUICKENING
+	free(vm.guard_misses);
+	vm.guard_misses = NULL;
+#endif
+	return result;
+}
 
-	chunk_free(&chunk);
 
-	return result;
+#ifdef QUICKENING
+void quicken_report() {
+	fprintf(stderr, "== quickening ==\n");
+	fprintf(stderr, "%-22s %12s %14s %12s\n", "opcode", "rewrites", "guard failures", "pinned sites");
+	for (int op = 0; op < OPCODE_COUNT; op++) {
+		if (quickenings[op] == 0 && guard_failures[op] == 0 && pinned_sites[op] == 0) continue;
+		fprintf(stderr, "%-22s %12llu %14llu %12llu\n", opcode_name(op),
+			(unsigned long long)quickenings[op], (unsigned long long)guard_failures[op],
+			(unsigned long long)pinned_sites[op]);
+	}
 }
+#endif
 
 
 void vm_push(Value value) {